@@ -0,0 +1,345 @@
+/* Adaptive anti-aliasing of a frame rendered at one sample per pixel,
+   whatever renderer made it: only the pixels on an edge get more
+   samples, the flat areas that make up most of an image keep their
+   single one.
+
+   A pixel is an edge when a color channel differs from one of its four
+   neighbours by more than the threshold, or when one of the two is
+   inside the set and the other is not. Edge pixels get FIRST_ROUND more
+   samples; those whose samples still disagree by more than the
+   threshold get the rest, up to max_samples in all. Samples are
+   iterated with the kernels of the renderers, in the precision of the
+   render options, and colored with the ColorMap of the frame, so that
+   their average stays in the palette. The iteration counts of the frame
+   are those of the first sample and are left as they are.
+
+   Positions come from the R2 low-discrepancy sequence, shifted by a
+   hash of the pixel: spread evenly over the pixel whatever the count,
+   but not the same pattern on every pixel, which would alias again.
+   A frame that is a band of a larger image sees no neighbours past
+   its first and last rows; given the row the band starts at, it takes
+   the samples the whole image would.*/
+
+#ifndef ANTIALIAS_HPP
+#define ANTIALIAS_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "colorizer.hpp"
+#include "cpu_renderer.hpp"
+#include "simd_kernel.hpp"
+#include "thread_pool.hpp"
+#include "variant_kernel.hpp"
+
+namespace CPU
+{
+    struct AntiAliasOptions
+    {
+        // samples of an edge pixel at most, its first one included;
+        // 1 turns anti-aliasing off
+        int max_samples = 16;
+        // difference of a color channel, out of 255, that makes an edge
+        int threshold = 24;
+    };
+
+    struct AntiAliasStats
+    {
+        // pixels found on an edge, and those of them that took more
+        // than the first round
+        std::size_t edges = 0,
+                    refined = 0;
+        // samples added
+        std::uint64_t samples = 0;
+        KernelStats kernel;
+    };
+
+    class AntiAliaser
+    {
+    public:
+        AntiAliaser(ThreadPool &thread_pool, const RenderOptions &render_options,
+                    const AntiAliasOptions &antialias_options = AntiAliasOptions())
+            : pool(thread_pool), options(render_options), aa(antialias_options)
+        {}
+
+        RenderOptions &renderOptions()
+        {
+            return options;
+        }
+
+        AntiAliasOptions &antiAliasOptions()
+        {
+            return aa;
+        }
+
+        const AntiAliasStats &lastStats() const
+        {
+            return stats;
+        }
+
+        // --------------------
+        // frame is view at one sample per pixel, colored with map;
+        // first_row is the row of the image the frame starts at when
+        // it is one of its bands
+        void apply(const View &view, Frame &frame, const ColorMap &map, const int first_row = 0)
+        {
+            stats = AntiAliasStats();
+            if (aa.max_samples <= 1 || frame.width <= 0 || frame.height <= 0) {
+                return;
+            }
+
+            switch (options.precision) {
+                case Precision::Double:
+                applyAs <double>(view, frame, map, first_row);
+                break;
+                case Precision::DoubleDouble:
+                applyAs <DoubleDouble>(view, frame, map, first_row);
+                break;
+                case Precision::QuadDouble:
+                applyAs <QuadDouble>(view, frame, map, first_row);
+                break;
+                default:
+                applyAs <float>(view, frame, map, first_row);
+            }
+        }
+
+    private:
+        static constexpr int FIRST_ROUND = 4;
+
+        ThreadPool &pool;
+        RenderOptions options;
+        AntiAliasOptions aa;
+        AntiAliasStats stats;
+
+        // -----------------
+        // samples of the pixels of one row, and their colors summed up
+        template <class Real>
+        struct Batch
+        {
+            std::vector <Real> cr, ci, zr, zi;
+            std::vector <int> counts;
+            std::vector <float> magnitudes;
+            std::vector <std::uint8_t> rgba;
+        };
+
+        struct Pixel
+        {
+            int x;
+            int samples;
+            std::uint32_t sum[3];
+            std::uint8_t low[3], high[3];
+        };
+
+        template <class Real>
+        void applyAs(const View &view, Frame &frame, const ColorMap &map, const int first_row)
+        {
+            const Kernel <Real> kernel = kernelFor <Real>(options.isa, options.interior_checks,
+                                                          options.variant.smooth);
+            const VariantKernel <Real> variant_kernel =
+                options.variant.isPlainMandelbrot() ? nullptr :
+                                                      variantKernelFor <Real>(options.variant);
+
+            // ---------------
+            // edges are found on the colors of the first samples, before
+            // any of them changes
+            const std::vector <std::uint8_t> first = frame.rgba;
+            std::vector <AntiAliasStats> worker_stats(pool.size());
+
+            pool.run(static_cast <std::size_t>(frame.height),
+                     [&](const std::size_t task, const unsigned worker) {
+                const int row = static_cast <int>(task);
+                AntiAliasStats &row_stats = worker_stats[worker];
+                std::vector <Pixel> pixels;
+
+                for (int x = 0; x < frame.width; ++x) {
+                    if (isEdge(frame, first, view.iterations, x, row)) {
+                        const std::uint8_t *color = &first[pixelOf(frame, x, row) * 4];
+                        Pixel pixel = {x, 1, {color[0], color[1], color[2]},
+                                       {color[0], color[1], color[2]},
+                                       {color[0], color[1], color[2]}};
+                        pixels.push_back(pixel);
+                    }
+                }
+                if (pixels.empty()) {
+                    return;
+                }
+                row_stats.edges += pixels.size();
+
+                Batch <Real> batch;
+                const int first_round = std::min(FIRST_ROUND, aa.max_samples - 1);
+                sampleRow(kernel, variant_kernel, view, map, row, first_row, pixels, 0,
+                          first_round, batch, row_stats);
+
+                // ---------------
+                // the rest, where the first round did not agree
+                std::vector <Pixel> unsettled;
+                for (const Pixel &pixel : pixels) {
+                    if (spread(pixel) > aa.threshold) {
+                        unsettled.push_back(pixel);
+                    }
+                }
+                if (!unsettled.empty() && aa.max_samples - 1 > first_round) {
+                    row_stats.refined += unsettled.size();
+                    sampleRow(kernel, variant_kernel, view, map, row, first_row, unsettled,
+                              first_round, aa.max_samples - 1, batch, row_stats);
+                    for (const Pixel &pixel : unsettled) {
+                        *std::find_if(pixels.begin(), pixels.end(), [&](const Pixel &p) {
+                            return p.x == pixel.x;
+                        }) = pixel;
+                    }
+                }
+
+                for (const Pixel &pixel : pixels) {
+                    std::uint8_t *color = &frame.rgba[pixelOf(frame, pixel.x, row) * 4];
+                    for (int c = 0; c < 3; ++c) {
+                        color[c] = static_cast <std::uint8_t>(
+                            (pixel.sum[c] + pixel.samples / 2) / pixel.samples);
+                    }
+                }
+            });
+
+            for (const AntiAliasStats &s : worker_stats) {
+                stats.edges += s.edges;
+                stats.refined += s.refined;
+                stats.samples += s.samples;
+                stats.kernel += s.kernel;
+            }
+        }
+
+        // -----------------
+        // samples [from, to) of the sequence of every pixel of the row,
+        // in one kernel call
+        template <class Real>
+        void sampleRow(const Kernel <Real> kernel, const VariantKernel <Real> variant_kernel,
+                       const View &view, const ColorMap &map, const int row,
+                       const int first_row, std::vector <Pixel> &pixels, const int from, const int to,
+                       Batch <Real> &batch, AntiAliasStats &row_stats) const
+        {
+            const int per_pixel = to - from;
+            const int n = static_cast <int>(pixels.size()) * per_pixel;
+            if (n <= 0) {
+                return;
+            }
+
+            batch.cr.resize(n);
+            batch.ci.resize(n);
+            batch.zr.resize(n);
+            batch.zi.resize(n);
+            batch.counts.resize(n);
+            batch.magnitudes.resize(n);
+            batch.rgba.resize(static_cast <std::size_t>(n) * 4);
+
+            int k = 0;
+            for (const Pixel &pixel : pixels) {
+                const std::uint32_t seed = hash(pixel.x, first_row + row);
+                for (int s = from; s < to; ++s, ++k) {
+                    double dx, dy;
+                    position(seed, s, dx, dy);
+                    batch.cr[k] = pointOf <Real>(view.cx, view.offsetRe(pixel.x + dx));
+                    batch.ci[k] = pointOf <Real>(view.cy, view.offsetIm(row + dy));
+                }
+            }
+
+            if (variant_kernel) {
+                variant_kernel(batch.cr.data(), batch.ci.data(), n, view.iterations,
+                               options.variant, batch.counts.data(), batch.magnitudes.data(),
+                               row_stats.kernel);
+            }
+            else {
+                kernel(batch.cr.data(), batch.ci.data(), n, view.iterations, batch.counts.data(),
+                       batch.zr.data(), batch.zi.data(), row_stats.kernel);
+                storeMagnitudes(batch.zr.data(), batch.zi.data(), batch.counts.data(), n,
+                                view.iterations, batch.magnitudes.data());
+            }
+            map.color(batch.counts.data(), batch.magnitudes.data(), n, batch.rgba.data());
+            row_stats.samples += n;
+
+            k = 0;
+            for (Pixel &pixel : pixels) {
+                for (int s = from; s < to; ++s, ++k) {
+                    const std::uint8_t *color = &batch.rgba[static_cast <std::size_t>(k) * 4];
+                    for (int c = 0; c < 3; ++c) {
+                        pixel.sum[c] += color[c];
+                        pixel.low[c] = std::min(pixel.low[c], color[c]);
+                        pixel.high[c] = std::max(pixel.high[c], color[c]);
+                    }
+                }
+                pixel.samples += per_pixel;
+            }
+        }
+
+        static std::size_t pixelOf(const Frame &frame, const int x, const int row)
+        {
+            return static_cast <std::size_t>(row) * frame.width + x;
+        }
+
+        bool differ(const Frame &frame, const std::vector <std::uint8_t> &rgba,
+                    const int iterations, const std::size_t p, const std::size_t q) const
+        {
+            if ((frame.iterations[p] >= iterations) != (frame.iterations[q] >= iterations)) {
+                return true;
+            }
+            for (int c = 0; c < 3; ++c) {
+                if (std::abs(rgba[p * 4 + c] - rgba[q * 4 + c]) > aa.threshold) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool isEdge(const Frame &frame, const std::vector <std::uint8_t> &rgba,
+                    const int iterations, const int x, const int row) const
+        {
+            const std::size_t p = pixelOf(frame, x, row);
+            return (x > 0 && differ(frame, rgba, iterations, p, p - 1)) ||
+                   (x + 1 < frame.width && differ(frame, rgba, iterations, p, p + 1)) ||
+                   (row > 0 && differ(frame, rgba, iterations, p, p - frame.width)) ||
+                   (row + 1 < frame.height && differ(frame, rgba, iterations, p, p + frame.width));
+        }
+
+        static int spread(const Pixel &pixel)
+        {
+            int most = 0;
+            for (int c = 0; c < 3; ++c) {
+                most = std::max(most, pixel.high[c] - pixel.low[c]);
+            }
+            return most;
+        }
+
+        // -----------------
+        // sample s of the pixel with the given seed, as an offset from
+        // its center in [-0.5, 0.5) pixels: the R2 sequence (Roberts),
+        // rotated by the seed
+        static void position(const std::uint32_t seed, const int s, double &dx, double &dy)
+        {
+            const double a1 = 0.7548776662466927,
+                         a2 = 0.5698402909980532;
+            const double u = (seed & 0xffff) / 65536.0,
+                         v = (seed >> 16) / 65536.0;
+            dx = fraction(u + (s + 1) * a1) - 0.5;
+            dy = fraction(v + (s + 1) * a2) - 0.5;
+        }
+
+        static double fraction(const double x)
+        {
+            return x - static_cast <long long>(x);
+        }
+
+        static std::uint32_t hash(const int x, const int row)
+        {
+            std::uint32_t h = static_cast <std::uint32_t>(x) * 0x9e3779b1u ^
+                              static_cast <std::uint32_t>(row) * 0x85ebca77u;
+            h ^= h >> 16;
+            h *= 0x7feb352du;
+            h ^= h >> 15;
+            h *= 0x846ca68bu;
+            h ^= h >> 16;
+            return h;
+        }
+    };
+};
+
+#endif  //ANTIALIAS_HPP
@@ -0,0 +1,409 @@
+/* Benchmark of the CPU engine, to keep track of its speed from one
+   commit, or one machine, to the next.
+   A fixed set of views is rendered with every kernel the CPU runs, in
+   every precision tier that resolves the view (multi-double tiers only
+   have a scalar kernel) and with every thread count asked for. Each
+   case is rendered a few times and the median run is kept; the tile
+   latency percentiles are taken over the tiles of all runs.
+
+   Results go to the console and to a JSON file, one case per line, and
+   a file written by an earlier run can be given with -c to print the
+   speed ratio of every case found in both.
+
+   usage: mandelbrot_bench [options]
+     -w <width>     image width (default 320)
+     -h <height>    image height (default 240)
+     -r <runs>      runs per case (default 3)
+     -t <threads>   thread counts, comma separated (default 1 and all
+                    cores)
+     -p <tiers>     precision tiers, comma separated among float,
+                    double, dd and qd (default all); tiers too coarse
+                    for a view are skipped anyway. qd is by far the
+                    slowest, at about 1/100 of the speed of double.
+     -v <view>      only this view: full-set, seahorse-valley,
+                    deep-minibrot or interior (default all)
+     -l <label>     stored with the results, for example the commit
+     -o <file>      JSON results (default bench.json)
+     -c <file>      JSON results of an earlier run to compare with*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpu_renderer.hpp"
+
+namespace
+{
+    struct BenchView
+    {
+        const char *name;
+        const char *cx, *cy;
+        double zoom;
+        int iterations;
+    };
+
+    // ------------------
+    // the whole set; the spirals of the seahorse valley, mostly
+    // escaping points with long orbits; a period 23 minibrot on the
+    // real axis, about 1e-13 wide, which needs double-double; and a
+    // view filled by the period 4 bulb and its neighbours, where nearly
+    // every point runs into the cap or into periodicity checking
+    const BenchView VIEWS[] = {
+        {"full-set", "-0.5", "0", 1, 256},
+        {"seahorse-valley", "-0.7453", "0.1127", 150, 1000},
+        {"deep-minibrot", "-1.9487134756524007", "0", 2e12, 2000},
+        {"interior", "-1.3", "0", 10, 10000},
+    };
+
+    struct Case
+    {
+        std::string view,
+                    precision,
+                    kernel;
+        unsigned threads;
+        double seconds,
+               mpixel_per_s,
+               miterations_per_s,
+               tile_p50_ms,
+               tile_p99_ms;
+    };
+
+    // ------------------
+    // nearest rank, of sorted values
+    double percentile(const std::vector <double> &sorted, const double p)
+    {
+        if (sorted.empty()) {
+            return 0;
+        }
+        const std::size_t rank = static_cast <std::size_t>(std::ceil(p * sorted.size()));
+        return sorted[std::min(std::max(rank, std::size_t(1)), sorted.size()) - 1];
+    }
+
+    Case run(CPU::Renderer &renderer, const BenchView &bench_view, const CPU::View &view,
+             const int runs)
+    {
+        using Clock = std::chrono::steady_clock;
+        const CPU::RenderOptions &options = renderer.renderOptions();
+
+        CPU::Frame frame;
+        std::vector <double> seconds, tiles;
+        std::uint64_t iterations = 0;
+
+        for (int r = 0; r < runs; ++r) {
+            const Clock::time_point start = Clock::now();
+            renderer.render(view, frame);
+            seconds.push_back(std::chrono::duration <double>(Clock::now() - start).count());
+
+            iterations = renderer.lastStats().iterations;
+            const std::vector <double> &tile_seconds = renderer.lastTileSeconds();
+            tiles.insert(tiles.end(), tile_seconds.begin(), tile_seconds.end());
+        }
+        std::sort(seconds.begin(), seconds.end());
+        std::sort(tiles.begin(), tiles.end());
+
+        const bool multi_double = options.precision == CPU::Precision::DoubleDouble ||
+                                  options.precision == CPU::Precision::QuadDouble;
+
+        Case result;
+        result.view = bench_view.name;
+        result.precision = CPU::precisionName(options.precision);
+        result.kernel = multi_double ? "scalar" : CPU::isaName(options.isa);
+        result.threads = renderer.threadPool().size();
+        result.seconds = seconds[seconds.size() / 2];
+        result.mpixel_per_s = static_cast <double>(view.width) * view.height / result.seconds / 1e6;
+        result.miterations_per_s = iterations / result.seconds / 1e6;
+        result.tile_p50_ms = percentile(tiles, 0.5) * 1e3;
+        result.tile_p99_ms = percentile(tiles, 0.99) * 1e3;
+        return result;
+    }
+
+    std::string key(const std::string &view, const std::string &precision,
+                    const std::string &kernel, const unsigned threads)
+    {
+        return view + ' ' + precision + ' ' + kernel + ' ' + std::to_string(threads);
+    }
+
+    // ------------------
+    // value of "name": in a line of a results file, quotes removed
+    std::string field(const std::string &line, const std::string &name)
+    {
+        const std::size_t at = line.find('"' + name + "\":");
+        if (at == std::string::npos) {
+            return "";
+        }
+
+        std::size_t begin = line.find_first_not_of(' ', at + name.size() + 3);
+        if (begin == std::string::npos) {
+            return "";
+        }
+        if (line[begin] == '"') {
+            ++begin;
+            return line.substr(begin, line.find('"', begin) - begin);
+        }
+        return line.substr(begin, line.find_first_of(",}", begin) - begin);
+    }
+
+    // ------------------
+    // Mpixel/s of every case of a file written by writeResults()
+    std::map <std::string, double> readBaseline(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("Cannot open " + path + "\n");
+        }
+
+        std::map <std::string, double> speeds;
+        std::string line;
+        while (std::getline(in, line)) {
+            const std::string view = field(line, "view");
+            if (view.empty()) {
+                continue;
+            }
+            speeds[key(view, field(line, "precision"), field(line, "kernel"),
+                       static_cast <unsigned>(std::atoi(field(line, "threads").c_str())))] =
+                std::atof(field(line, "mpixel_per_s").c_str());
+        }
+        return speeds;
+    }
+
+    std::string escape(const std::string &text)
+    {
+        std::string escaped;
+        for (const char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+            }
+            escaped += c >= ' ' ? c : ' ';
+        }
+        return escaped;
+    }
+
+    void writeResults(const std::string &path, const std::string &label, const int width,
+                      const int height, const int runs, const std::vector <Case> &cases)
+    {
+        std::ofstream out(path);
+        if (!out) {
+            throw std::runtime_error("Cannot open " + path + " for writing\n");
+        }
+
+        char date[32];
+        const std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        out << "{\n"
+            << "  \"label\": \"" << escape(label) << "\",\n"
+            << "  \"date\": \"" << date << "\",\n"
+#ifdef __VERSION__
+            << "  \"compiler\": \"" << escape(__VERSION__) << "\",\n"
+#endif
+            << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n"
+            << "  \"widest_kernel\": \"" << CPU::isaName(CPU::detectIsa()) << "\",\n"
+            << "  \"width\": " << width << ",\n"
+            << "  \"height\": " << height << ",\n"
+            << "  \"runs\": " << runs << ",\n"
+            << "  \"cases\": [\n";
+
+        out << std::setprecision(6);
+        for (std::size_t c = 0; c < cases.size(); ++c) {
+            const Case &r = cases[c];
+            out << "    {\"view\": \"" << r.view << "\", \"precision\": \"" << r.precision
+                << "\", \"kernel\": \"" << r.kernel << "\", \"threads\": " << r.threads
+                << ", \"seconds\": " << r.seconds << ", \"mpixel_per_s\": " << r.mpixel_per_s
+                << ", \"miterations_per_s\": " << r.miterations_per_s
+                << ", \"tile_p50_ms\": " << r.tile_p50_ms
+                << ", \"tile_p99_ms\": " << r.tile_p99_ms << '}'
+                << (c + 1 < cases.size() ? "," : "") << '\n';
+        }
+        out << "  ]\n}\n";
+
+        if (!out) {
+            throw std::runtime_error("Cannot write " + path + "\n");
+        }
+    }
+
+    std::vector <unsigned> parseThreads(const char *list)
+    {
+        std::vector <unsigned> threads;
+        std::istringstream in(list);
+        std::string item;
+        while (std::getline(in, item, ',')) {
+            const int count = std::atoi(item.c_str());
+            if (count <= 0) {
+                throw std::invalid_argument(std::string("Bad thread count list ") + list + "\n");
+            }
+            threads.push_back(static_cast <unsigned>(count));
+        }
+        return threads;
+    }
+
+    std::vector <bool> parseTiers(const char *list)
+    {
+        static const char *names[] = {"float", "double", "dd", "qd"};
+
+        std::vector <bool> tiers(4, false);
+        std::istringstream in(list);
+        std::string item;
+        while (std::getline(in, item, ',')) {
+            const auto name = std::find(std::begin(names), std::end(names), item);
+            if (name == std::end(names)) {
+                throw std::invalid_argument("Unknown precision " + item + "\n");
+            }
+            tiers[name - std::begin(names)] = true;
+        }
+        return tiers;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int width = 320,
+        height = 240,
+        runs = 3;
+    std::string only_view,
+                label,
+                output = "bench.json",
+                baseline_path;
+    std::vector <unsigned> thread_counts = {1, std::max(std::thread::hardware_concurrency(), 1u)};
+    std::vector <bool> tiers(4, true);
+
+    try {
+        for (int a = 1; a + 1 < argc; a += 2) {
+            const char *key = argv[a],
+                       *value = argv[a + 1];
+
+            if (!std::strcmp(key, "-w"))      width = std::atoi(value);
+            else if (!std::strcmp(key, "-h")) height = std::atoi(value);
+            else if (!std::strcmp(key, "-r")) runs = std::atoi(value);
+            else if (!std::strcmp(key, "-t")) thread_counts = parseThreads(value);
+            else if (!std::strcmp(key, "-p")) tiers = parseTiers(value);
+            else if (!std::strcmp(key, "-v")) only_view = value;
+            else if (!std::strcmp(key, "-l")) label = value;
+            else if (!std::strcmp(key, "-o")) output = value;
+            else if (!std::strcmp(key, "-c")) baseline_path = value;
+            else {
+                std::cout << "Unknown option " << key << '\n';
+                return 1;
+            }
+        }
+
+        if (width <= 0 || height <= 0 || runs <= 0) {
+            std::cout << "Width, height and runs must be positive\n";
+            return 1;
+        }
+
+        std::sort(thread_counts.begin(), thread_counts.end());
+        thread_counts.erase(std::unique(thread_counts.begin(), thread_counts.end()),
+                            thread_counts.end());
+
+        std::map <std::string, double> baseline;
+        if (!baseline_path.empty()) {
+            baseline = readBaseline(baseline_path);
+        }
+
+        std::vector <CPU::Isa> kernels;
+        for (const CPU::Isa isa : {CPU::Isa::Scalar, CPU::Isa::SSE2, CPU::Isa::AVX2, CPU::Isa::AVX512}) {
+            if (CPU::isaSupported(isa)) {
+                kernels.push_back(isa);
+            }
+        }
+
+        std::cout << std::left << std::setw(17) << "view" << std::setw(15) << "precision"
+                  << std::setw(8) << "kernel" << std::right << std::setw(8) << "threads"
+                  << std::setw(11) << "Mpixel/s" << std::setw(11) << "Miter/s"
+                  << std::setw(11) << "p50 ms" << std::setw(11) << "p99 ms"
+                  << (baseline.empty() ? "" : "    vs baseline") << '\n'
+                  << std::fixed;
+
+        std::vector <Case> cases;
+        bool matched = only_view.empty();
+
+        for (const BenchView &bench_view : VIEWS) {
+            if (!only_view.empty() && only_view != bench_view.name) {
+                continue;
+            }
+            matched = true;
+
+            CPU::View view;
+            view.cx = QuadDouble::fromString(bench_view.cx);
+            view.cy = QuadDouble::fromString(bench_view.cy);
+            view.zoom = bench_view.zoom;
+            view.iterations = bench_view.iterations;
+            view.width = width;
+            view.height = height;
+
+            const CPU::Precision needed = CPU::selectPrecision(view.zoom, view.height);
+
+            for (const unsigned threads : thread_counts) {
+                CPU::Renderer renderer(threads);
+
+                for (int tier = static_cast <int>(needed);
+                     tier <= static_cast <int>(CPU::Precision::QuadDouble); ++tier) {
+                    if (!tiers[tier]) {
+                        continue;
+                    }
+
+                    const CPU::Precision precision = static_cast <CPU::Precision>(tier);
+                    const bool vector_kernels = precision == CPU::Precision::Float ||
+                                                precision == CPU::Precision::Double;
+
+                    for (const CPU::Isa isa : kernels) {
+                        if (!vector_kernels && isa != CPU::Isa::Scalar) {
+                            continue;
+                        }
+                        renderer.renderOptions().precision = precision;
+                        renderer.renderOptions().isa = isa;
+
+                        const Case result = run(renderer, bench_view, view, runs);
+                        cases.push_back(result);
+
+                        std::cout << std::left << std::setw(17) << result.view
+                                  << std::setw(15) << result.precision
+                                  << std::setw(8) << result.kernel << std::right
+                                  << std::setw(8) << result.threads
+                                  << std::setprecision(2) << std::setw(11) << result.mpixel_per_s
+                                  << std::setw(11) << result.miterations_per_s
+                                  << std::setw(11) << result.tile_p50_ms
+                                  << std::setw(11) << result.tile_p99_ms;
+
+                        const auto before = baseline.find(key(result.view, result.precision,
+                                                              result.kernel, result.threads));
+                        if (before != baseline.end() && before->second > 0) {
+                            std::cout << "    x" << std::setprecision(3)
+                                      << result.mpixel_per_s / before->second;
+                        }
+                        std::cout << std::endl;
+                    }
+                }
+            }
+        }
+
+        if (!matched) {
+            std::cout << "Unknown view " << only_view << '\n';
+            return 1;
+        }
+
+        writeResults(output, label, width, height, runs, cases);
+        std::cout << cases.size() << " cases written to " << output << '\n';
+    }
+    catch (std::exception &e) {
+        std::cout << "ERROR::BENCH\n" << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,300 @@
+/* Coloring as a pass of its own over the counts and magnitudes that a
+   renderer leaves in a Frame, so that another palette or normalisation
+   costs one pass over the pixels instead of iterating them again:
+
+   - smooth adds to every escaped count the fraction of an iteration
+     smoothFraction() gets from |z|. The radius of 2 of the banded
+     kernels only softens the bands, the smooth variants escape at 256
+     for a continuous gradient;
+   - equalize replaces a count by the share of escaped pixels that
+     escaped sooner, which spreads the colors evenly over the pixels
+     whatever the range of the counts. Its histogram is a parallel
+     reduction: every worker counts its chunks into a histogram of its
+     own, then slices of bins are summed across workers, one task per
+     slice;
+   - the palette: classic is gen_color of mandelbrot.fs, the others are
+     mirrored there under PALETTE.
+
+   Pixels inside the set are black with every palette. With the default
+   options and the variant the frame was rendered with, the pass gives
+   the colors the renderers already wrote.*/
+
+#ifndef COLORIZER_HPP
+#define COLORIZER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cpu_renderer.hpp"
+#include "fractal_variant.hpp"
+#include "thread_pool.hpp"
+#include "variant_kernel.hpp"
+
+namespace CPU
+{
+    enum class Palette {Classic, Fire, Cyclic, Grey};
+    constexpr int PALETTES = 4;
+
+    inline const char *paletteName(const Palette palette)
+    {
+        switch (palette) {
+            case Palette::Fire:
+            return "fire";
+            case Palette::Cyclic:
+            return "cyclic";
+            case Palette::Grey:
+            return "grey";
+            default:
+            return "classic";
+        }
+    }
+
+    inline bool parsePalette(const std::string &name, Palette &palette)
+    {
+        for (int p = 0; p < PALETTES; ++p) {
+            if (name == paletteName(static_cast <Palette>(p))) {
+                palette = static_cast <Palette>(p);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // ------------------
+    // color of t in [0, 1), black from 1 on (inside the set)
+    inline void paletteColor(const Palette palette, const float t, std::uint8_t *rgba)
+    {
+        if (palette == Palette::Classic || t >= 1.0f) {
+            genColor(std::min(t, 1.0f), rgba);
+            return;
+        }
+
+        float r, g, b;
+        switch (palette) {
+            case Palette::Fire:
+            r = 3.0f * t;
+            g = 3.0f * t - 1.0f;
+            b = 3.0f * t - 2.0f;
+            break;
+            case Palette::Cyclic:
+            r = 0.5f + 0.5f * std::cos(6.2831853f * (4.0f * t));
+            g = 0.5f + 0.5f * std::cos(6.2831853f * (4.0f * t + 0.1f));
+            b = 0.5f + 0.5f * std::cos(6.2831853f * (4.0f * t + 0.2f));
+            break;
+            default:
+            r = g = b = t;
+        }
+
+        rgba[0] = toByte(r);
+        rgba[1] = toByte(g);
+        rgba[2] = toByte(b);
+        rgba[3] = 255;
+    }
+
+    struct ColorOptions
+    {
+        Palette palette = Palette::Classic;
+        bool smooth = false,
+             equalize = false;
+    };
+
+    // ------------------
+    // bins[i]: how many pixels escaped after i iterations
+    struct Histogram
+    {
+        std::vector <std::uint64_t> bins;
+
+        explicit Histogram(const int iterations = 0)
+            : bins(static_cast <std::size_t>(std::max(iterations, 0)), 0)
+        {}
+
+        void add(const int *counts, const std::size_t count)
+        {
+            const int cap = static_cast <int>(bins.size());
+            for (std::size_t k = 0; k < count; ++k) {
+                if (counts[k] >= 0 && counts[k] < cap) {
+                    ++bins[counts[k]];
+                }
+            }
+        }
+
+        Histogram &operator+=(const Histogram &other)
+        {
+            bins.resize(std::max(bins.size(), other.bins.size()), 0);
+            for (std::size_t i = 0; i < other.bins.size(); ++i) {
+                bins[i] += other.bins[i];
+            }
+            return *this;
+        }
+
+        // ------------------
+        // of counts, on every worker of pool
+        static Histogram of(ThreadPool &pool, const int *counts, const std::size_t count,
+                            const int iterations)
+        {
+            const std::size_t chunks = (count + CHUNK - 1) / CHUNK;
+            std::vector <Histogram> partial(pool.size());
+
+            pool.run(chunks, [&](const std::size_t chunk, const unsigned worker) {
+                Histogram &mine = partial[worker];
+                if (mine.bins.empty()) {
+                    mine = Histogram(iterations);
+                }
+                const std::size_t first = chunk * CHUNK;
+                mine.add(counts + first, std::min(CHUNK, count - first));
+            });
+
+            Histogram sum(iterations);
+            const std::size_t slices = (sum.bins.size() + SLICE - 1) / SLICE;
+            pool.run(slices, [&](const std::size_t slice, unsigned) {
+                const std::size_t first = slice * SLICE,
+                                  last = std::min(first + SLICE, sum.bins.size());
+                for (const Histogram &h : partial) {
+                    for (std::size_t i = first; i < last && i < h.bins.size(); ++i) {
+                        sum.bins[i] += h.bins[i];
+                    }
+                }
+            });
+            return sum;
+        }
+
+    private:
+        static constexpr std::size_t CHUNK = 1 << 16,
+                                     SLICE = 1 << 12;
+    };
+
+    // ------------------
+    // what the counts of one image map to: its iteration cap, the
+    // escape radius and exponent it was rendered with, and, to
+    // equalize, the distribution of its counts
+    class ColorMap
+    {
+    public:
+        ColorMap(const int iterations, const double escape_radius, const int power,
+                 const ColorOptions &color_options)
+            : cap(std::max(iterations, 1)), scale(escape_radius, power), options(color_options)
+        {
+            buildTable();
+        }
+
+        ColorMap(const int iterations, const FractalVariant &variant,
+                 const ColorOptions &color_options)
+            : ColorMap(iterations, variant.escapeRadius(), variant.power, color_options)
+        {}
+
+        const ColorOptions &colorOptions() const
+        {
+            return options;
+        }
+
+        int iterations() const
+        {
+            return cap;
+        }
+
+        // ------------------
+        // to call before coloring when options.equalize is set;
+        // shares[i] is the part of the escaped pixels that escaped
+        // before i iterations
+        void equalize(const Histogram &histogram)
+        {
+            std::uint64_t total = 0;
+            for (const std::uint64_t n : histogram.bins) {
+                total += n;
+            }
+
+            shares.assign(static_cast <std::size_t>(cap) + 1, 1.0f);
+            std::uint64_t below = 0;
+            for (int i = 0; i < cap; ++i) {
+                shares[i] = total ? static_cast <float>(static_cast <double>(below) / total) : 0.0f;
+                below += i < static_cast <int>(histogram.bins.size()) ? histogram.bins[i] : 0;
+            }
+            buildTable();
+        }
+
+        // ------------------
+        // without smooth coloring, a color depends on the count only
+        // and comes from a table of cap + 1 of them
+        void color(const int *counts, const float *magnitudes, const std::size_t count,
+                   std::uint8_t *rgba) const
+        {
+            if (!options.smooth) {
+                for (std::size_t k = 0; k < count; ++k) {
+                    const int i = std::min(std::max(counts[k], 0), cap);
+                    std::copy_n(&table[static_cast <std::size_t>(i) * 4], 4, &rgba[k * 4]);
+                }
+                return;
+            }
+
+            for (std::size_t k = 0; k < count; ++k) {
+                const int i = counts[k];
+                paletteColor(options.palette,
+                             i < cap ? shade(i, scale.fraction(magnitudes[k])) : 1.0f,
+                             &rgba[k * 4]);
+            }
+        }
+
+    private:
+        int cap;
+        SmoothScale scale;
+        ColorOptions options;
+        std::vector <float> shares;
+        std::vector <std::uint8_t> table;
+
+        // ------------------
+        // t of the palette for an escaped count plus fraction
+        float shade(const int i, const float fraction) const
+        {
+            const float t = !shares.empty() ? shares[i] + fraction * (shares[i + 1] - shares[i]) :
+                                              (i + fraction) / cap;
+            // ---------------
+            // the last share may round up to 1, which is black
+            return std::min(t, 0.99999994f);
+        }
+
+        void buildTable()
+        {
+            if (options.smooth) {
+                return;
+            }
+            table.resize((static_cast <std::size_t>(cap) + 1) * 4);
+            for (int i = 0; i <= cap; ++i) {
+                paletteColor(options.palette, i < cap ? shade(i, 0.0f) : 1.0f,
+                             &table[static_cast <std::size_t>(i) * 4]);
+            }
+        }
+    };
+
+    // ------------------
+    // colors of frame with map as it is, a few rows per task
+    inline void colorFrame(ThreadPool &pool, Frame &frame, const ColorMap &map)
+    {
+        const int rows = std::max(4096 / std::max(frame.width, 1), 1),
+                  tasks = (frame.height + rows - 1) / rows;
+        pool.run(static_cast <std::size_t>(tasks), [&](const std::size_t task, unsigned) {
+            const int first = static_cast <int>(task) * rows,
+                      last = std::min(first + rows, frame.height);
+            const std::size_t p = static_cast <std::size_t>(first) * frame.width,
+                              n = static_cast <std::size_t>(last - first) * frame.width;
+            map.color(&frame.iterations[p], &frame.magnitudes[p], n, &frame.rgba[p * 4]);
+        });
+    }
+
+    // ------------------
+    // the whole pass over a frame that is a whole image: its histogram
+    // first if it is equalized, then its colors
+    inline void colorize(ThreadPool &pool, Frame &frame, ColorMap &map)
+    {
+        if (map.colorOptions().equalize) {
+            const std::size_t size = static_cast <std::size_t>(frame.width) * frame.height;
+            map.equalize(Histogram::of(pool, frame.iterations.data(), size, map.iterations()));
+        }
+        colorFrame(pool, frame, map);
+    }
+};
+
+#endif  //COLORIZER_HPP
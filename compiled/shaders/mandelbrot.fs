@@ -7,53 +7,160 @@
 // - opengl used version changed
 // - all double typed variables changed on float
 // - gen color function name changed
+// - view parameters moved into a uniform block
+// - variants selected with preprocessor definitions
+// - palettes selected with PALETTE
+// - iteration moved into shade(), edges anti-aliased under SAMPLES
 
 #version 330 core
  
 out vec4 frag_color;
 
-uniform float screen_ratio;
-uniform float zoom;
-
-uniform vec2 screen_size;
-uniform vec2 center;
+// ------------------
+// std140, mirrored by GL::ViewBlock in main.cpp
+layout (std140) uniform View
+{
+    vec2 screen_size;
+    vec2 center;
+    float screen_ratio;
+    float zoom;
+    int iterations;
+};
 
-uniform int iterations;
+// ------------------
+// variant, defined by the loader right after #version (see
+// fractal_variant.hpp): FORMULA 0 is Mandelbrot, 1 Burning Ship and
+// 2 the Julia set of JULIA_C; POWER is the exponent of z; SMOOTH
+// colors with the fraction of an iteration where z escaped; with
+// FIXED_ITERATIONS the loop has a constant count and can be unrolled.
+// PALETTE picks the colors, as CPU::Palette in colorizer.hpp: 0 is
+// gen_color, 1 fire, 2 cyclic, 3 grey. With SAMPLES, a pixel on an
+// edge, whose color differs from its neighbours in the 2x2 quad by
+// more than EDGE, takes SAMPLES - 1 more samples spread over it, as
+// CPU::AntiAliaser does on the frames of the CPU
+#ifndef FORMULA
+#define FORMULA 0
+#endif
+#ifndef POWER
+#define POWER 2
+#endif
+#ifndef JULIA_C
+#define JULIA_C vec2(-0.8, 0.156)
+#endif
+#ifdef SMOOTH
+#define BAILOUT 65536.0
+#else
+#define BAILOUT 4.0
+#endif
+#ifdef FIXED_ITERATIONS
+#define ITERATIONS FIXED_ITERATIONS
+#else
+#define ITERATIONS iterations
+#endif
+#ifndef PALETTE
+#define PALETTE 0
+#endif
+#ifndef EDGE
+#define EDGE (24.0 / 255.0)
+#endif
  
 vec4 gen_color(const float t);
+float shade(const vec2 frag);
  
 void main()
 {
-    vec2 z, c;
-    c.x = screen_ratio * (gl_FragCoord.x / screen_size.x - 0.5) * 2;
-    c.y = (gl_FragCoord.y / screen_size.y - 0.5) * 2;
+    vec4 color = gen_color(shade(gl_FragCoord.xy));
+#ifdef SAMPLES
+    // ------------------
+    // offsets from the R2 sequence, rotated by a hash of the pixel
+    vec3 change = fwidth(color.rgb);
+    if (max(change.r, max(change.g, change.b)) > EDGE) {
+        vec2 seed = fract(sin(dot(gl_FragCoord.xy, vec2(12.9898, 78.233))) *
+                          vec2(43758.5453, 22578.1459));
+        vec4 sum = color;
+        for (int s = 1; s < SAMPLES; ++s) {
+            vec2 offset = fract(seed + float(s) * vec2(0.7548776662, 0.5698402910)) - 0.5;
+            sum += gen_color(shade(gl_FragCoord.xy + offset));
+        }
+        color = sum / float(SAMPLES);
+    }
+#endif
+    frag_color = color;
+}
+
+// ------------------
+// t of the palette for the point under frag, in window coordinates
+float shade(const vec2 frag)
+{
+    vec2 z = vec2(0.0), c;
+    c.x = screen_ratio * (frag.x / screen_size.x - 0.5) * 2;
+    c.y = (frag.y / screen_size.y - 0.5) * 2;
 
     c.x = c.x / zoom + center.x;
     c.y = c.y / zoom + center.y;
 
+#if FORMULA == 2
+    z = c;
+    c = JULIA_C;
+#endif
+
     int i;
+    float x, y;
     
-    for (i = 0; i < iterations; ++i) {
-        float x = (z.x * z.x - z.y * z.y) + c.x;
-		float y = (z.y * z.x + z.x * z.y) + c.y;
+    for (i = 0; i < ITERATIONS; ++i) {
+#if FORMULA == 1
+        vec2 w = abs(z);
+#else
+        vec2 w = z;
+#endif
+#if POWER == 2
+        x = (w.x * w.x - w.y * w.y) + c.x;
+		y = (w.y * w.x + w.x * w.y) + c.y;
+#else
+        vec2 p = w;
+        for (int k = 1; k < POWER; ++k) {
+            p = vec2(p.x * w.x - p.y * w.y, p.x * w.y + p.y * w.x);
+        }
+        x = p.x + c.x;
+        y = p.y + c.y;
+#endif
 
-		if (x * x + y * y > 4.0) 
+		if (x * x + y * y > BAILOUT) 
             break;
 
 		z.x = x;
 		z.y = y;
     }
  
-    float t = float(i) / iterations;
+    float t = float(i) / ITERATIONS;
+#ifdef SMOOTH
+    if (i < ITERATIONS) {
+        float ratio = log(x * x + y * y) / log(BAILOUT);
+        t = (float(i) + clamp(1.0 - log(ratio) / log(float(POWER)), 0.0, 0.999)) / ITERATIONS;
+    }
+#endif
 
-    frag_color = gen_color(t);
+    return t;
 }
 
 vec4 gen_color(const float t)
 {
+#if PALETTE == 0
     float r = 9.0 * (1.0 - t) * t * t * t,
           g = 15 * (1.0 - t) * (1.0 - t) * t * t,
           b = 8.5 * (1.0 - t) * (1.0 - t) * (1.0 - t) * t;
 
     return vec4(r, g, b, 1);
+#else
+    // inside the set
+    if (t >= 1.0)
+        return vec4(0, 0, 0, 1);
+#if PALETTE == 1
+    return vec4(clamp(vec3(3.0 * t) - vec3(0.0, 1.0, 2.0), 0.0, 1.0), 1);
+#elif PALETTE == 2
+    return vec4(0.5 + 0.5 * cos(6.2831853 * (4.0 * t + vec3(0.0, 0.1, 0.2))), 1);
+#else
+    return vec4(vec3(t), 1);
+#endif
+#endif
 }
\ No newline at end of file
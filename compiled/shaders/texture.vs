@@ -0,0 +1,12 @@
+#version 330 core
+
+layout (location = 0) in vec3 m_pos;
+
+out vec2 tex_coord;
+
+void main()
+{
+	// CPU frames are stored top row first
+	tex_coord = vec2(m_pos.x * 0.5 + 0.5, 0.5 - m_pos.y * 0.5);
+	gl_Position = vec4(m_pos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,634 @@
+/* Headless CPU counterpart of compiled/shaders/mandelbrot.fs.
+   It takes the same parameters main.cpp uploads as uniforms and
+   produces the same gen_color output, without a GL context. The frame
+   is cut into tiles that are scheduled on a work-stealing ThreadPool.
+
+   With RenderOptions::subdivide, tiles are rendered the Mariani-Silver
+   way: only the border of a rectangle is iterated, a rectangle whose
+   border is all at the iteration cap is filled with it, any other one
+   is split in two and both halves are handled the same way. The points
+   that reach the cap make a set without holes, so such a border can
+   only enclose points that reach it too. A rectangle whose border has
+   one single escape count is iterated in full instead: escaped points
+   are cheap, and each of them keeps its own |z| for smooth coloring
+   and counts files.
+
+   That holds for the set, not for its pixels: a filament thinner than
+   a pixel can cross a uniform border between two samples and hit a
+   pixel inside. Before a
+   rectangle is filled, the ring of pixels just inside its border and
+   a grid of lines through it are iterated as well, and any of them
+   off the border's count splits it; this catches most filaments, not
+   all of them. Subdivision is an approximation: a few isolated pixels
+   can differ from the brute-force render, which is the one to use
+   when counts must be exact.*/
+
+#ifndef CPU_RENDERER_HPP
+#define CPU_RENDERER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "multi_double.hpp"
+#include "fractal_variant.hpp"
+#include "simd_kernel.hpp"
+#include "thread_pool.hpp"
+#include "variant_kernel.hpp"
+
+namespace CPU
+{
+    // ------------------
+    // view parameters, same meaning as the uniforms of mandelbrot.fs
+    struct View
+    {
+        QuadDouble cx = -0.5,
+                   cy = 0;
+        double zoom = 1;
+        int iterations = 100;
+        int width = 1000,
+            height = 800;
+
+        double screenRatio() const
+        {
+            return static_cast <double>(width) / static_cast <double>(height);
+        }
+
+        // ---------------
+        // offset from the center of the point sampled by the pixel
+        // (x, row); row 0 is the top of the image, whereas gl_FragCoord.y
+        // grows upwards
+        double offsetRe(const double x) const
+        {
+            return screenRatio() * ((x + 0.5) / width - 0.5) * 2 / zoom;
+        }
+        double offsetIm(const double row) const
+        {
+            return ((height - row - 0.5) / height - 0.5) * 2 / zoom;
+        }
+
+        // ---------------
+        // the sampled point itself, in double precision
+        double re(const double x) const
+        {
+            return offsetRe(x) + cx.toDouble();
+        }
+        double im(const double row) const
+        {
+            return offsetIm(row) + cy.toDouble();
+        }
+    };
+
+    // ------------------
+    // rectangle of width x height pixels of view from (x0, y0), as a
+    // view of its own with the same pixel spacing
+    inline View regionOf(const View &view, const int x0, const int y0, const int width,
+                         const int height)
+    {
+        if (x0 == 0 && y0 == 0 && width == view.width && height == view.height) {
+            return view;
+        }
+
+        const double spacing = 2 / (view.zoom * view.height);
+        View region = view;
+        region.width = width;
+        region.height = height;
+        region.zoom = view.zoom * view.height / height;
+        region.cx = view.cx + QuadDouble((x0 + width / 2.0 - view.width / 2.0) * spacing);
+        region.cy = view.cy + QuadDouble((view.height / 2.0 - y0 - height / 2.0) * spacing);
+        return region;
+    }
+
+    // ------------------
+    // iteration counts and RGBA8 colors, row-major, top row first.
+    // magnitudes holds |z| where each point escaped, for colorizer.hpp
+    // to recolor the frame without iterating again; it is 0 inside the
+    // set, and everywhere with the tiled renderer, which does not keep
+    // it (render.cpp refuses -d there).
+    struct Frame
+    {
+        int width = 0,
+            height = 0;
+        std::vector <int> iterations;
+        std::vector <float> magnitudes;
+        std::vector <std::uint8_t> rgba;
+
+        void resize(const int w, const int h)
+        {
+            width = w;
+            height = h;
+            iterations.assign(static_cast <std::size_t>(w) * h, 0);
+            magnitudes.assign(static_cast <std::size_t>(w) * h, 0.0f);
+            rgba.assign(static_cast <std::size_t>(w) * h * 4, 0);
+        }
+    };
+
+    // ------------------
+    // |z| of the points of out that escaped, 0 for the others
+    template <class Real>
+    void storeMagnitudes(const Real *zr, const Real *zi, const int *out, const int count,
+                         const int iterations, float *magnitudes)
+    {
+        for (int k = 0; k < count; ++k) {
+            magnitudes[k] = out[k] < iterations ?
+                            static_cast <float>(std::sqrt(detail::asDouble(zr[k] * zr[k] +
+                                                                           zi[k] * zi[k]))) :
+                            0.0f;
+        }
+    }
+
+    // ------------------
+    // the loop of mandelbrot.fs: returns the number of iterations
+    // completed before |z|^2 went over 4
+    template <class Real>
+    int escapeTime(const Real cr, const Real ci, const int iterations)
+    {
+        Real zr = 0,
+             zi = 0;
+        int i;
+
+        for (i = 0; i < iterations; ++i) {
+            const Real x = (zr * zr - zi * zi) + cr;
+            const Real y = (zi * zr + zr * zi) + ci;
+
+            if (x * x + y * y > Real(4))
+                break;
+
+            zr = x;
+            zi = y;
+        }
+        return i;
+    }
+
+    // ------------------
+    // a color channel clamped and rounded the way the fragment output
+    // is converted to a normalized 8 bit framebuffer. The scaled value
+    // is at most 255 and exact in double, so adding a half there and
+    // truncating is std::lround, without the call.
+    inline std::uint8_t toByte(const float v)
+    {
+        const float scaled = std::min(std::max(v, 0.0f), 1.0f) * 255.0f;
+        return static_cast <std::uint8_t>(static_cast <double>(scaled) + 0.5);
+    }
+
+    // ------------------
+    // gen_color of mandelbrot.fs
+    inline void genColor(const float t, std::uint8_t *rgba)
+    {
+        const float r = 9.0f * (1.0f - t) * t * t * t,
+                    g = 15.0f * (1.0f - t) * (1.0f - t) * t * t,
+                    b = 8.5f * (1.0f - t) * (1.0f - t) * (1.0f - t) * t;
+
+        rgba[0] = toByte(r);
+        rgba[1] = toByte(g);
+        rgba[2] = toByte(b);
+        rgba[3] = 255;
+    }
+
+    // ------------------
+    // precision tiers, cheapest first
+    enum class Precision {Float, Double, DoubleDouble, QuadDouble};
+
+    inline const char *precisionName(const Precision precision)
+    {
+        switch (precision) {
+            case Precision::Double:
+            return "double";
+            case Precision::DoubleDouble:
+            return "double-double";
+            case Precision::QuadDouble:
+            return "quad-double";
+            default:
+            return "float";
+        }
+    }
+
+    // ------------------
+    // cheapest tier whose mantissa still resolves neighbouring pixels:
+    // the pixel spacing is 2 / (zoom * height) and a few more bits are
+    // kept for the rounding error the iterations pile up
+    inline Precision selectPrecision(const double zoom, const int height)
+    {
+        const int guard_bits = 6;
+        const double bits = std::log2(std::max(zoom, 1.0) * std::max(height, 1)) + guard_bits;
+
+        if (bits <= 24)
+            return Precision::Float;
+        if (bits <= 53)
+            return Precision::Double;
+        if (bits <= 106)
+            return Precision::DoubleDouble;
+        return Precision::QuadDouble;
+    }
+
+    // ------------------
+    // center + offset in the given precision. Float and double add in
+    // double first, like the shader adds center after the division.
+    template <class Real>
+    Real pointOf(const QuadDouble &center, const double offset)
+    {
+        if constexpr (std::is_same <Real, QuadDouble>::value)
+            return center + QuadDouble(offset);
+        else if constexpr (std::is_same <Real, DoubleDouble>::value)
+            return center.toDoubleDouble() + DoubleDouble(offset);
+        else
+            return static_cast <Real>(center.toDouble() + offset);
+    }
+
+    struct RenderOptions
+    {
+        int tile_size = 64;
+        Isa isa = detectIsa();
+        Precision precision = Precision::Float;
+        // cardioid / bulb test and periodicity checking
+        bool interior_checks = true;
+        // Mariani-Silver rectangle subdivision
+        bool subdivide = false;
+        // z^2 + c, banded or smooth, keeps the vectorized kernels; any
+        // other variant goes through the scalar kernels of
+        // variant_kernel.hpp, without subdivision
+        FractalVariant variant;
+    };
+
+    class Renderer
+    {
+    public:
+        explicit Renderer(const unsigned threads = std::thread::hardware_concurrency(),
+                          const RenderOptions &opts = RenderOptions())
+            : pool(threads), options(opts)
+        {}
+
+        ThreadPool &threadPool()
+        {
+            return pool;
+        }
+
+        RenderOptions &renderOptions()
+        {
+            return options;
+        }
+
+        // --------------------
+        // kernel counters of the last render() call
+        const KernelStats &lastStats() const
+        {
+            return stats;
+        }
+
+        // --------------------
+        // seconds each tile of the last render() call took, row-major
+        const std::vector <double> &lastTileSeconds() const
+        {
+            return tile_seconds;
+        }
+
+        // --------------------
+        // renders the whole view in the precision of the options
+        void render(const View &view, Frame &frame)
+        {
+            switch (options.precision) {
+                case Precision::Double:
+                renderAs <double>(view, frame);
+                break;
+                case Precision::DoubleDouble:
+                renderAs <DoubleDouble>(view, frame);
+                break;
+                case Precision::QuadDouble:
+                renderAs <QuadDouble>(view, frame);
+                break;
+                default:
+                renderAs <float>(view, frame);
+            }
+        }
+
+    private:
+        ThreadPool pool;
+        RenderOptions options;
+        KernelStats stats;
+        std::vector <double> tile_seconds;
+
+        template <class Real>
+        void renderAs(const View &view, Frame &frame)
+        {
+            const Kernel <Real> kernel = kernelFor <Real>(options.isa,
+                                                          options.interior_checks,
+                                                          options.variant.smooth);
+            const VariantKernel <Real> variant_kernel =
+                options.variant.isPlainMandelbrot() ? nullptr :
+                                                      variantKernelFor <Real>(options.variant);
+            std::vector <KernelStats> worker_stats(pool.size());
+
+            frame.resize(view.width, view.height);
+
+            const int tile = std::max(options.tile_size, 1),
+                      tiles_x = (view.width + tile - 1) / tile,
+                      tiles_y = (view.height + tile - 1) / tile;
+
+            tile_seconds.assign(static_cast <std::size_t>(tiles_x) * tiles_y, 0);
+
+            pool.run(tile_seconds.size(), [&](const std::size_t index, const unsigned worker) {
+                const auto start = std::chrono::steady_clock::now();
+                const int x0 = static_cast <int>(index % tiles_x) * tile,
+                          y0 = static_cast <int>(index / tiles_x) * tile;
+                const int x1 = std::min(x0 + tile, view.width),
+                          y1 = std::min(y0 + tile, view.height);
+
+                if (variant_kernel) {
+                    renderVariantTile(variant_kernel, options.variant, view, frame,
+                                      x0, y0, x1, y1, worker_stats[worker]);
+                }
+                else if (options.subdivide) {
+                    Subdivision <Real> subdivision(kernel, options.variant, view, frame,
+                                                   worker_stats[worker]);
+                    subdivision.render(x0, y0, x1, y1);
+                }
+                else {
+                    renderTile(kernel, options.variant, view, frame, x0, y0, x1, y1,
+                               worker_stats[worker]);
+                }
+
+                tile_seconds[index] = std::chrono::duration <double>(
+                    std::chrono::steady_clock::now() - start).count();
+            });
+
+            stats = KernelStats();
+            for (const KernelStats &s : worker_stats) {
+                stats += s;
+            }
+        }
+
+        // -----------------
+        // one kernel call per tile row; variant is z^2 + c, banded or
+        // smooth
+        template <class Real>
+        static void renderTile(const Kernel <Real> kernel, const FractalVariant &variant,
+                               const View &view, Frame &frame, const int x0, const int y0,
+                               const int x1, const int y1, KernelStats &stats)
+        {
+            const SmoothScale scale(variant.escapeRadius(), variant.power);
+            const int n = x1 - x0;
+            std::vector <Real> cr(n), ci(n), zr(n), zi(n);
+
+            for (int x = x0; x < x1; ++x) {
+                cr[x - x0] = pointOf <Real>(view.cx, view.offsetRe(x));
+            }
+
+            for (int row = y0; row < y1; ++row) {
+                const std::size_t first = static_cast <std::size_t>(row) * frame.width + x0;
+                int *out = &frame.iterations[first];
+
+                std::fill(ci.begin(), ci.end(), pointOf <Real>(view.cy, view.offsetIm(row)));
+                kernel(cr.data(), ci.data(), n, view.iterations, out, zr.data(), zi.data(), stats);
+                storeMagnitudes(zr.data(), zi.data(), out, n, view.iterations,
+                                &frame.magnitudes[first]);
+
+                for (int k = 0; k < n; ++k) {
+                    const float fraction = variant.smooth ?
+                        scale.fraction(frame.magnitudes[first + k]) : 0.0f;
+                    genColor((out[k] + fraction) / view.iterations,
+                             &frame.rgba[(first + k) * 4]);
+                }
+            }
+        }
+
+        // -----------------
+        // renderTile() for the other variants; smooth coloring adds
+        // the fraction of an iteration to the count
+        template <class Real>
+        static void renderVariantTile(const VariantKernel <Real> kernel,
+                                      const FractalVariant &variant, const View &view,
+                                      Frame &frame, const int x0, const int y0,
+                                      const int x1, const int y1, KernelStats &stats)
+        {
+            const int n = x1 - x0;
+            std::vector <Real> cr(n), ci(n);
+
+            for (int x = x0; x < x1; ++x) {
+                cr[x - x0] = pointOf <Real>(view.cx, view.offsetRe(x));
+            }
+
+            for (int row = y0; row < y1; ++row) {
+                const std::size_t first = static_cast <std::size_t>(row) * frame.width + x0;
+                int *out = &frame.iterations[first];
+                float *magnitudes = &frame.magnitudes[first];
+
+                std::fill(ci.begin(), ci.end(), pointOf <Real>(view.cy, view.offsetIm(row)));
+                kernel(cr.data(), ci.data(), n, view.iterations, variant, out, magnitudes, stats);
+
+                for (int k = 0; k < n; ++k) {
+                    const float fraction = variant.smooth ?
+                        smoothFraction(magnitudes[k], variant.escapeRadius(), variant.power) : 0.0f;
+                    genColor((out[k] + fraction) / view.iterations,
+                             &frame.rgba[(first + k) * 4]);
+                }
+            }
+        }
+
+        // -----------------
+        // Mariani-Silver rendering of one tile. Pixels of the tile hold
+        // -1 until they are known, so a border shared by the two halves
+        // of a split is only iterated once.
+        template <class Real>
+        class Subdivision
+        {
+        public:
+            Subdivision(const Kernel <Real> k, const FractalVariant &variant, const View &v,
+                        Frame &f, KernelStats &s)
+                : kernel(k), smooth(variant.smooth),
+                  scale(variant.escapeRadius(), variant.power), view(v), frame(f), stats(s)
+            {}
+
+            void render(const int x0, const int y0, const int x1, const int y1)
+            {
+                for (int row = y0; row < y1; ++row) {
+                    std::fill_n(&at(x0, row), x1 - x0, -1);
+                }
+
+                rectangle(x0, y0, x1, y1);
+
+                for (int row = y0; row < y1; ++row) {
+                    for (int x = x0; x < x1; ++x) {
+                        const std::size_t p = static_cast <std::size_t>(row) * frame.width + x;
+                        const float fraction = smooth ? scale.fraction(frame.magnitudes[p]) : 0.0f;
+                        genColor((frame.iterations[p] + fraction) / view.iterations,
+                                 &frame.rgba[p * 4]);
+                    }
+                }
+            }
+
+        private:
+            static constexpr int SMALL_AREA = 256,
+                                 PROBE_STEP = 8;
+
+            const Kernel <Real> kernel;
+            const bool smooth;
+            const SmoothScale scale;
+            const View &view;
+            Frame &frame;
+            KernelStats &stats;
+
+            // ---------------
+            // pixels waiting for one batched kernel call
+            std::vector <Real> cr, ci, zr, zi;
+            std::vector <int *> targets;
+            std::vector <int> counts;
+            std::vector <float> magnitudes;
+
+            int &at(const int x, const int row)
+            {
+                return frame.iterations[static_cast <std::size_t>(row) * frame.width + x];
+            }
+
+            void queue(const int x, const int row)
+            {
+                int &count = at(x, row);
+                if (count < 0) {
+                    count = 0;
+                    cr.push_back(pointOf <Real>(view.cx, view.offsetRe(x)));
+                    ci.push_back(pointOf <Real>(view.cy, view.offsetIm(row)));
+                    targets.push_back(&count);
+                }
+            }
+
+            void flush()
+            {
+                const int n = static_cast <int>(targets.size());
+                counts.resize(n);
+                zr.resize(n);
+                zi.resize(n);
+                magnitudes.resize(n);
+                kernel(cr.data(), ci.data(), n, view.iterations, counts.data(),
+                       zr.data(), zi.data(), stats);
+                storeMagnitudes(zr.data(), zi.data(), counts.data(), n, view.iterations,
+                                magnitudes.data());
+
+                for (int k = 0; k < n; ++k) {
+                    *targets[k] = counts[k];
+                    frame.magnitudes[targets[k] - frame.iterations.data()] = magnitudes[k];
+                }
+                cr.clear();
+                ci.clear();
+                targets.clear();
+            }
+
+            // ---------------
+            // [x0, x1) x [y0, y1)
+            void rectangle(const int x0, const int y0, const int x1, const int y1)
+            {
+                // ---------------
+                // one side after the other, so that neighbouring points
+                // share SIMD groups and finish at about the same time
+                for (int x = x0; x < x1; ++x) {
+                    queue(x, y0);
+                }
+                for (int x = x0; x < x1; ++x) {
+                    queue(x, y1 - 1);
+                }
+                for (int row = y0 + 1; row < y1 - 1; ++row) {
+                    queue(x0, row);
+                }
+                for (int row = y0 + 1; row < y1 - 1; ++row) {
+                    queue(x1 - 1, row);
+                }
+                flush();
+
+                if (x1 - x0 <= 2 || y1 - y0 <= 2) {
+                    return;
+                }
+
+                // ---------------
+                // the borders of small rectangles make batches too short
+                // to fill the SIMD lanes, iterating their inside is cheaper
+                if ((x1 - x0) * (y1 - y0) <= SMALL_AREA) {
+                    iterateInside(x0, y0, x1, y1);
+                    return;
+                }
+
+                const int value = at(x0, y0);
+                bool uniform = true;
+                for (int x = x0; x < x1 && uniform; ++x) {
+                    uniform = at(x, y0) == value && at(x, y1 - 1) == value;
+                }
+                for (int row = y0 + 1; row < y1 - 1 && uniform; ++row) {
+                    uniform = at(x0, row) == value && at(x1 - 1, row) == value;
+                }
+
+                if (uniform && value == view.iterations && probe(x0, y0, x1, y1, value)) {
+                    // ---------------
+                    // |z| stays 0, as for any point inside the set
+                    for (int row = y0 + 1; row < y1 - 1; ++row) {
+                        for (int x = x0 + 1; x < x1 - 1; ++x) {
+                            if (at(x, row) < 0) {
+                                at(x, row) = value;
+                                frame.magnitudes[static_cast <std::size_t>(row) * frame.width + x] = 0;
+                                ++stats.filled;
+                            }
+                        }
+                    }
+                    return;
+                }
+                if (uniform && value < view.iterations) {
+                    iterateInside(x0, y0, x1, y1);
+                    return;
+                }
+
+                // ---------------
+                // the halves share the middle line
+                if (x1 - x0 >= y1 - y0) {
+                    const int middle = (x0 + x1) / 2;
+                    rectangle(x0, y0, middle + 1, y1);
+                    rectangle(middle, y0, x1, y1);
+                }
+                else {
+                    const int middle = (y0 + y1) / 2;
+                    rectangle(x0, y0, x1, middle + 1);
+                    rectangle(x0, middle, x1, y1);
+                }
+            }
+
+            void iterateInside(const int x0, const int y0, const int x1, const int y1)
+            {
+                for (int row = y0 + 1; row < y1 - 1; ++row) {
+                    for (int x = x0 + 1; x < x1 - 1; ++x) {
+                        queue(x, row);
+                    }
+                }
+                flush();
+            }
+
+            // ---------------
+            // a uniform border is not enough: a filament thinner than a
+            // pixel can cross it between two samples. The ring of pixels
+            // just inside and a grid of lines PROBE_STEP apart are
+            // iterated too, and the rectangle is only filled when all of
+            // them have the border's count
+            bool probe(const int x0, const int y0, const int x1, const int y1, const int value)
+            {
+                for (int row = y0 + 1; row < y1 - 1; ++row) {
+                    const bool line = row == y0 + 1 || row == y1 - 2 || (row - y0) % PROBE_STEP == 0;
+                    for (int x = x0 + 1; x < x1 - 1; ++x) {
+                        if (line || x == x0 + 1 || x == x1 - 2 || (x - x0) % PROBE_STEP == 0) {
+                            queue(x, row);
+                        }
+                    }
+                }
+                flush();
+
+                for (int row = y0 + 1; row < y1 - 1; ++row) {
+                    for (int x = x0 + 1; x < x1 - 1; ++x) {
+                        if (at(x, row) >= 0 && at(x, row) != value) {
+                            return false;
+                        }
+                    }
+                }
+                return true;
+            }
+        };
+    };
+};
+
+#endif  //CPU_RENDERER_HPP
@@ -0,0 +1,1104 @@
+/* Rendering spread over worker processes, on this machine or others.
+   A coordinator cuts each view it renders into tiles and deals them to
+   the workers connected to it over TCP; a worker renders its tiles
+   with a Renderer of its own and sends back their iteration counts.
+   The coordinator is a renderer like the others, render() returns the
+   whole frame, so bands, colors and counts files work as they do
+   locally (see render.cpp).
+
+   - Workers pull: every worker holds up to prefetch tiles, the one it
+     renders and the next ones, so that it never waits for a round
+     trip. A worker left with nothing once the queue is empty steals
+     the last tile another one holds but has not started (that one is
+     told to drop it), and when every remaining tile is started, takes
+     a copy of one that has run for much longer than tiles usually do.
+     The first result of a tile wins, later ones are dropped.
+   - A worker whose connection closes has the tiles it held put back at
+     the front of the queue.
+   - Counts travel as runs of equal values, each one the difference
+     with the previous run and its length, both as variable length
+     integers: the inside of the set and slow gradients cost a few
+     bytes per run instead of 4 per pixel. |z| follows for the pixels
+     that escaped, only when the coordinator asks for it (smooth
+     coloring, counts files).
+
+   Everything on the wire is byte order independent: variable length
+   integers, and doubles as their IEEE bits, low byte first.*/
+
+#ifndef DISTRIBUTED_RENDERER_HPP
+#define DISTRIBUTED_RENDERER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "colorizer.hpp"
+#include "cpu_renderer.hpp"
+#include "multi_double.hpp"
+#include "socket.hpp"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+extern char **environ;
+#endif
+
+namespace CPU
+{
+    namespace wire
+    {
+        constexpr std::uint64_t VERSION = 1;
+
+        // ------------------
+        // side of the largest tile a coordinator deals, and the largest
+        // payload a message can have: the Done of such a tile, where a
+        // count takes at most 6 bytes (a 5 byte difference and a 1 byte
+        // run) and |z| 4, plus a few variable length integers. A longer
+        // message is refused before any of it is buffered, so that a
+        // peer cannot make the other end allocate without limit.
+        constexpr int MAX_TILE = 128;
+        constexpr std::uint64_t MAX_PAYLOAD = MAX_TILE * MAX_TILE * (6 + 4) + 256;
+
+        // ------------------
+        // Hello: version, threads                      (worker)
+        // Job: job, view, options, magnitudes wanted   (coordinator)
+        // Tile: job, tile, x0, y0, width, height       (coordinator)
+        // Cancel: job, tile                            (coordinator)
+        // Quit                                         (coordinator)
+        // Start: job, tile                             (worker)
+        // Done: job, tile, kernel stats, counts, |z|   (worker)
+        //
+        // Done carries |z| only if the Job asked for it, and then only
+        // for the pixels whose count, as sent in the same message, is
+        // under the iteration cap: the worker's counts decide how many
+        // follow. A Done that is cut short, has more counts than the
+        // tile has pixels, a count out of [0, cap] or an unknown tile
+        // throws, and the worker is dropped; its tiles go back to the
+        // queue. So does any message longer than MAX_PAYLOAD.
+        enum Message : std::uint8_t
+        {
+            Hello = 'H', Job = 'J', Tile = 'T', Cancel = 'C', Quit = 'Q', Start = 'S', Done = 'D'
+        };
+
+        class Writer
+        {
+        public:
+            std::vector <std::uint8_t> bytes;
+
+            void byte(const std::uint8_t value)
+            {
+                bytes.push_back(value);
+            }
+
+            void varint(std::uint64_t value)
+            {
+                while (value >= 0x80) {
+                    bytes.push_back(static_cast <std::uint8_t>(value | 0x80));
+                    value >>= 7;
+                }
+                bytes.push_back(static_cast <std::uint8_t>(value));
+            }
+
+            // ------------------
+            // zigzag: small negative numbers stay short
+            void integer(const std::int64_t value)
+            {
+                varint((static_cast <std::uint64_t>(value) << 1) ^
+                       static_cast <std::uint64_t>(value >> 63));
+            }
+
+            void real(const double value)
+            {
+                std::uint64_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                for (int b = 0; b < 8; ++b) {
+                    bytes.push_back(static_cast <std::uint8_t>(bits >> (8 * b)));
+                }
+            }
+
+            void real32(const float value)
+            {
+                std::uint32_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                for (int b = 0; b < 4; ++b) {
+                    bytes.push_back(static_cast <std::uint8_t>(bits >> (8 * b)));
+                }
+            }
+
+            void quad(const QuadDouble &value)
+            {
+                for (const double part : value.x) {
+                    real(part);
+                }
+            }
+        };
+
+        class Reader
+        {
+        public:
+            Reader(const std::uint8_t *data, const std::size_t size)
+                : at(data), end(data + size)
+            {}
+
+            std::uint8_t byte()
+            {
+                need(1);
+                return *at++;
+            }
+
+            std::uint64_t varint()
+            {
+                std::uint64_t value = 0;
+                for (int shift = 0; shift < 64; shift += 7) {
+                    const std::uint8_t b = byte();
+                    value |= static_cast <std::uint64_t>(b & 0x7f) << shift;
+                    if (!(b & 0x80)) {
+                        return value;
+                    }
+                }
+                throw std::runtime_error("wire: bad integer\n");
+            }
+
+            std::int64_t integer()
+            {
+                const std::uint64_t value = varint();
+                return static_cast <std::int64_t>(value >> 1) ^ -static_cast <std::int64_t>(value & 1);
+            }
+
+            double real()
+            {
+                need(8);
+                std::uint64_t bits = 0;
+                for (int b = 0; b < 8; ++b) {
+                    bits |= static_cast <std::uint64_t>(*at++) << (8 * b);
+                }
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return value;
+            }
+
+            float real32()
+            {
+                need(4);
+                std::uint32_t bits = 0;
+                for (int b = 0; b < 4; ++b) {
+                    bits |= static_cast <std::uint32_t>(*at++) << (8 * b);
+                }
+                float value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return value;
+            }
+
+            QuadDouble quad()
+            {
+                QuadDouble value;
+                for (double &part : value.x) {
+                    part = real();
+                }
+                return value;
+            }
+
+        private:
+            const std::uint8_t *at,
+                               *end;
+
+            void need(const std::size_t size) const
+            {
+                if (static_cast <std::size_t>(end - at) < size) {
+                    throw std::runtime_error("wire: message cut short\n");
+                }
+            }
+        };
+
+        // ------------------
+        // a message is its type, the length of its payload and the
+        // payload
+        inline void send(Socket &socket, const Message type, const Writer &payload = Writer())
+        {
+            Writer frame;
+            frame.byte(type);
+            frame.varint(payload.bytes.size());
+            frame.bytes.insert(frame.bytes.end(), payload.bytes.begin(), payload.bytes.end());
+            socket.sendAll(frame.bytes.data(), frame.bytes.size());
+        }
+
+        // ------------------
+        // bytes received on a connection, cut into messages
+        class Inbox
+        {
+        public:
+            // ------------------
+            // what has arrived; false once the connection is closed
+            bool fill(Socket &socket)
+            {
+                std::uint8_t chunk[1 << 16];
+                const std::size_t size = socket.receive(chunk, sizeof(chunk));
+                buffer.erase(buffer.begin(), buffer.begin() + read);
+                read = 0;
+                buffer.insert(buffer.end(), chunk, chunk + size);
+                return size > 0;
+            }
+
+            // ------------------
+            // the next complete message, if there is one
+            bool next(Message &type, std::vector <std::uint8_t> &payload)
+            {
+                std::size_t at = read + 1;
+                std::uint64_t length = 0;
+                for (int shift = 0; ; shift += 7) {
+                    if (at >= buffer.size()) {
+                        return false;
+                    }
+                    if (shift > 56) {
+                        throw std::runtime_error("wire: bad message length\n");
+                    }
+                    const std::uint8_t b = buffer[at++];
+                    length |= static_cast <std::uint64_t>(b & 0x7f) << shift;
+                    if (!(b & 0x80)) {
+                        break;
+                    }
+                }
+                if (length > MAX_PAYLOAD) {
+                    throw std::runtime_error("wire: message too long\n");
+                }
+                if (buffer.size() - at < length) {
+                    return false;
+                }
+
+                type = static_cast <Message>(buffer[read]);
+                payload.assign(buffer.begin() + at, buffer.begin() + at + length);
+                read = at + length;
+                return true;
+            }
+
+        private:
+            std::vector <std::uint8_t> buffer;
+            std::size_t read = 0;
+        };
+
+        // ------------------
+        // runs of equal counts: the difference with the count of the
+        // previous run, then the length of the run minus 1
+        inline void writeCounts(Writer &out, const int *counts, const std::size_t count)
+        {
+            int previous = 0;
+            for (std::size_t k = 0; k < count; ) {
+                std::size_t run = 1;
+                while (k + run < count && counts[k + run] == counts[k]) {
+                    ++run;
+                }
+                out.integer(static_cast <std::int64_t>(counts[k]) - previous);
+                out.varint(run - 1);
+                previous = counts[k];
+                k += run;
+            }
+        }
+
+        inline void readCounts(Reader &in, int *counts, const std::size_t count)
+        {
+            std::int64_t previous = 0;
+            for (std::size_t k = 0; k < count; ) {
+                const std::int64_t value = previous + in.integer();
+                const std::uint64_t run = in.varint() + 1;
+                if (run > count - k) {
+                    throw std::runtime_error("wire: counts overflow the tile\n");
+                }
+                std::fill_n(counts + k, run, static_cast <int>(value));
+                previous = value;
+                k += run;
+            }
+        }
+
+        inline void writeView(Writer &out, const View &view)
+        {
+            out.quad(view.cx);
+            out.quad(view.cy);
+            out.real(view.zoom);
+            out.varint(static_cast <std::uint64_t>(view.iterations));
+            out.varint(static_cast <std::uint64_t>(view.width));
+            out.varint(static_cast <std::uint64_t>(view.height));
+        }
+
+        inline View readView(Reader &in)
+        {
+            View view;
+            view.cx = in.quad();
+            view.cy = in.quad();
+            view.zoom = in.real();
+            view.iterations = static_cast <int>(in.varint());
+            view.width = static_cast <int>(in.varint());
+            view.height = static_cast <int>(in.varint());
+            return view;
+        }
+
+        // ------------------
+        // all of the options but the kernel, which every worker picks
+        // for its own CPU
+        inline void writeOptions(Writer &out, const RenderOptions &options)
+        {
+            out.varint(static_cast <std::uint64_t>(options.tile_size));
+            out.byte(static_cast <std::uint8_t>(options.precision));
+            out.byte(options.interior_checks);
+            out.byte(options.subdivide);
+            out.byte(static_cast <std::uint8_t>(options.variant.formula));
+            out.varint(static_cast <std::uint64_t>(options.variant.power));
+            out.byte(options.variant.smooth);
+            out.real(options.variant.julia_re);
+            out.real(options.variant.julia_im);
+        }
+
+        inline void readOptions(Reader &in, RenderOptions &options)
+        {
+            options.tile_size = static_cast <int>(in.varint());
+            options.precision = static_cast <Precision>(std::min <int>(in.byte(), 3));
+            options.interior_checks = in.byte() != 0;
+            options.subdivide = in.byte() != 0;
+            options.variant.formula = static_cast <Formula>(std::min <int>(in.byte(), 2));
+            options.variant.power = static_cast <int>(in.varint());
+            options.variant.smooth = in.byte() != 0;
+            options.variant.julia_re = in.real();
+            options.variant.julia_im = in.real();
+        }
+
+        inline void writeStats(Writer &out, const KernelStats &stats)
+        {
+            out.varint(stats.iterations);
+            out.varint(stats.cardioid_saved);
+            out.varint(stats.periodicity_saved);
+            out.varint(stats.filled);
+        }
+
+        inline KernelStats readStats(Reader &in)
+        {
+            KernelStats stats;
+            stats.iterations = in.varint();
+            stats.cardioid_saved = in.varint();
+            stats.periodicity_saved = in.varint();
+            stats.filled = in.varint();
+            return stats;
+        }
+    };
+
+    struct DistributedOptions
+    {
+        // side of the tiles dealt to workers, in pixels, at most
+        // wire::MAX_TILE
+        int tile_size = wire::MAX_TILE;
+        // tiles a worker holds at most, the one it renders included
+        int prefetch = 2;
+        // |z| of escaped pixels sent back, for smooth coloring and
+        // counts files
+        bool magnitudes = false;
+        // seconds render() waits for a worker when none is connected
+        double worker_timeout = 30;
+    };
+
+    struct DistributedStats
+    {
+        std::size_t tiles = 0,
+                    // taken from the prefetched tiles of another worker
+                    stolen = 0,
+                    // copies of slow tiles given to an idle worker
+                    backups = 0,
+                    // put back in the queue after their worker died
+                    requeued = 0,
+                    // results of tiles already done, dropped
+                    duplicates = 0,
+                    workers = 0;
+        // payload of the results, and the size of the raw counts and
+        // magnitudes they stand for
+        std::uint64_t received_bytes = 0,
+                      raw_bytes = 0;
+        KernelStats kernel;
+
+        DistributedStats &operator+=(const DistributedStats &other)
+        {
+            tiles += other.tiles;
+            stolen += other.stolen;
+            backups += other.backups;
+            requeued += other.requeued;
+            duplicates += other.duplicates;
+            workers = std::max(workers, other.workers);
+            received_bytes += other.received_bytes;
+            raw_bytes += other.raw_bytes;
+            kernel += other.kernel;
+            return *this;
+        }
+    };
+
+    class DistributedRenderer
+    {
+    public:
+        DistributedRenderer(const RenderOptions &render_options,
+                            const DistributedOptions &distributed_options = DistributedOptions())
+            : options(render_options), distributed(distributed_options)
+        {}
+
+        DistributedRenderer(const DistributedRenderer &) = delete;
+        DistributedRenderer &operator=(const DistributedRenderer &) = delete;
+
+        // ------------------
+        // workers are told to quit, the local ones are waited for
+        ~DistributedRenderer()
+        {
+            for (const std::unique_ptr <Peer> &peer : peers) {
+                try {
+                    wire::send(peer->socket, wire::Quit);
+                }
+                catch (std::exception &) {
+                }
+                peer->socket.close();
+            }
+            for (const auto child : children) {
+#ifdef _WIN32
+                int status;
+                _cwait(&status, child, 0);
+#else
+                int status;
+                waitpid(child, &status, 0);
+#endif
+            }
+        }
+
+        RenderOptions &renderOptions()
+        {
+            return options;
+        }
+
+        DistributedOptions &distributedOptions()
+        {
+            return distributed;
+        }
+
+        const DistributedStats &lastStats() const
+        {
+            return stats;
+        }
+
+        // ------------------
+        // opens port (0 for any) for workers, on the loopback interface
+        // only unless remote workers are welcome; returns the port
+        int listen(const int port, const bool remote)
+        {
+            listener = Socket::listen(port, !remote);
+            return listener.port();
+        }
+
+        // ------------------
+        // starts count workers on this machine: program (this one) run
+        // with worker_arguments, then -W and the address to connect to
+        void spawnWorkers(const std::string &program, const int count,
+                          const std::vector <std::string> &worker_arguments)
+        {
+            std::vector <std::string> arguments = {program};
+            arguments.insert(arguments.end(), worker_arguments.begin(), worker_arguments.end());
+            arguments.push_back("-W");
+            arguments.push_back("127.0.0.1:" + std::to_string(listener.port()));
+
+            std::vector <char *> argv;
+            for (std::string &argument : arguments) {
+                argv.push_back(&argument[0]);
+            }
+            argv.push_back(nullptr);
+
+            for (int w = 0; w < count; ++w) {
+#ifdef _WIN32
+                const intptr_t child = _spawnv(_P_NOWAIT, program.c_str(), argv.data());
+                if (child == -1) {
+#else
+                pid_t child;
+                if (posix_spawnp(&child, program.c_str(), nullptr, nullptr, argv.data(), environ)) {
+#endif
+                    throw std::runtime_error("DistributedRenderer: cannot start " + program + "\n");
+                }
+                children.push_back(child);
+            }
+        }
+
+        // ------------------
+        // renders the whole view on the workers, in the precision of
+        // the options, and colors it as the other renderers do
+        void render(const View &view, Frame &frame)
+        {
+            if (!listener.isOpen()) {
+                throw std::runtime_error("DistributedRenderer: listen() first\n");
+            }
+
+            ++job;
+            stats = DistributedStats();
+            frame.resize(view.width, view.height);
+            target = &frame;
+            current = view;
+            map.reset(new ColorMap(view.iterations, options.variant, colorOptions()));
+
+            // ---------------
+            // the queue, row-major
+            const int tile = std::min(std::max(distributed.tile_size, 8), wire::MAX_TILE);
+            tiles.clear();
+            queue.clear();
+            for (int y0 = 0; y0 < view.height; y0 += tile) {
+                for (int x0 = 0; x0 < view.width; x0 += tile) {
+                    TileState state;
+                    state.x0 = x0;
+                    state.y0 = y0;
+                    state.width = std::min(tile, view.width - x0);
+                    state.height = std::min(tile, view.height - y0);
+                    tiles.push_back(state);
+                    queue.push_back(static_cast <int>(tiles.size()) - 1);
+                }
+            }
+            remaining = tiles.size();
+            stats.tiles = tiles.size();
+            done_seconds = 0;
+            done_count = 0;
+
+            for (const std::unique_ptr <Peer> &peer : peers) {
+                peer->held.clear();
+                peer->running = -1;
+                if (peer->ready) {
+                    sendJob(*peer);
+                }
+            }
+
+            Clock::time_point alone_since = Clock::now();
+            while (remaining > 0) {
+                deal();
+
+                std::vector <const Socket *> sockets = {&listener};
+                for (const std::unique_ptr <Peer> &peer : peers) {
+                    sockets.push_back(&peer->socket);
+                }
+                const std::vector <bool> ready = Socket::readable(sockets, 0.25);
+
+                if (ready[0]) {
+                    try {
+                        peers.emplace_back(new Peer(listener.accept()));
+                    }
+                    catch (std::exception &) {
+                    }
+                }
+                for (std::size_t p = 0; p < ready.size() - 1; ++p) {
+                    if (ready[p + 1]) {
+                        receive(*peers[p]);
+                    }
+                }
+                bury();
+
+                // ---------------
+                // a coordinator without workers gives up after a while
+                const bool alone = std::none_of(peers.begin(), peers.end(),
+                                                [](const std::unique_ptr <Peer> &peer) {
+                    return peer->ready;
+                });
+                if (!alone) {
+                    alone_since = Clock::now();
+                }
+                else if (seconds(alone_since) > distributed.worker_timeout) {
+                    throw std::runtime_error("DistributedRenderer: no worker connected\n");
+                }
+            }
+
+            stats.workers = std::count_if(peers.begin(), peers.end(),
+                                          [](const std::unique_ptr <Peer> &peer) {
+                return peer->ready;
+            });
+            target = nullptr;
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct TileState
+        {
+            int x0, y0, width, height;
+            bool done = false;
+            // workers that hold the tile
+            int holders = 0;
+            Clock::time_point started;
+        };
+
+        struct Peer
+        {
+            Socket socket;
+            wire::Inbox inbox;
+            bool ready = false,
+                 dead = false;
+            std::uint64_t job = 0;
+            // tiles of the current job sent to the worker and neither
+            // done nor cancelled, and the one it said it works on
+            std::vector <int> held;
+            int running = -1;
+
+            explicit Peer(Socket connection)
+                : socket(std::move(connection))
+            {}
+        };
+
+        RenderOptions options;
+        DistributedOptions distributed;
+        DistributedStats stats;
+
+        Socket listener;
+        std::vector <std::unique_ptr <Peer>> peers;
+#ifdef _WIN32
+        std::vector <intptr_t> children;
+#else
+        std::vector <pid_t> children;
+#endif
+
+        std::uint64_t job = 0;
+        View current;
+        Frame *target = nullptr;
+        std::unique_ptr <ColorMap> map;
+        std::vector <TileState> tiles;
+        std::deque <int> queue;
+        std::size_t remaining = 0;
+        double done_seconds = 0;
+        std::size_t done_count = 0;
+
+        static double seconds(const Clock::time_point since)
+        {
+            return std::chrono::duration <double>(Clock::now() - since).count();
+        }
+
+        ColorOptions colorOptions() const
+        {
+            ColorOptions color;
+            color.smooth = options.variant.smooth;
+            return color;
+        }
+
+        void sendJob(Peer &peer)
+        {
+            // ---------------
+            // a tile is split again among the threads of a worker
+            RenderOptions job_options = options;
+            job_options.tile_size = std::max(std::min(options.tile_size,
+                                                      distributed.tile_size / 4), 8);
+
+            wire::Writer out;
+            out.varint(job);
+            wire::writeView(out, current);
+            wire::writeOptions(out, job_options);
+            out.byte(distributed.magnitudes);
+            send(peer, wire::Job, out);
+            peer.job = job;
+        }
+
+        void send(Peer &peer, const wire::Message type, const wire::Writer &payload)
+        {
+            if (peer.dead) {
+                return;
+            }
+            try {
+                wire::send(peer.socket, type, payload);
+            }
+            catch (std::exception &) {
+                peer.dead = true;
+            }
+        }
+
+        void assign(Peer &peer, const int index)
+        {
+            const TileState &tile = tiles[index];
+            wire::Writer out;
+            out.varint(job);
+            out.varint(static_cast <std::uint64_t>(index));
+            out.varint(static_cast <std::uint64_t>(tile.x0));
+            out.varint(static_cast <std::uint64_t>(tile.y0));
+            out.varint(static_cast <std::uint64_t>(tile.width));
+            out.varint(static_cast <std::uint64_t>(tile.height));
+            send(peer, wire::Tile, out);
+
+            peer.held.push_back(index);
+            ++tiles[index].holders;
+        }
+
+        // ------------------
+        // the tile is no longer the peer's; false if it was not
+        bool release(Peer &peer, const int index)
+        {
+            const auto found = std::find(peer.held.begin(), peer.held.end(), index);
+            if (found == peer.held.end()) {
+                return false;
+            }
+            peer.held.erase(found);
+            --tiles[index].holders;
+            return true;
+        }
+
+        void cancel(Peer &peer, const int index)
+        {
+            if (release(peer, index)) {
+                wire::Writer out;
+                out.varint(job);
+                out.varint(static_cast <std::uint64_t>(index));
+                send(peer, wire::Cancel, out);
+            }
+        }
+
+        // ------------------
+        // tops up every worker from the queue, then lets the idle ones
+        // steal
+        void deal()
+        {
+            for (const std::unique_ptr <Peer> &peer : peers) {
+                if (!peer->ready || peer->dead) {
+                    continue;
+                }
+                while (static_cast <int>(peer->held.size()) < std::max(distributed.prefetch, 1) &&
+                       !queue.empty()) {
+                    assign(*peer, queue.front());
+                    queue.pop_front();
+                }
+                if (peer->held.empty() && queue.empty()) {
+                    steal(*peer);
+                }
+            }
+        }
+
+        void steal(Peer &thief)
+        {
+            // ---------------
+            // the last tile of the worker that holds the most ones it
+            // has not started
+            Peer *victim = nullptr;
+            std::size_t most = 0;
+            for (const std::unique_ptr <Peer> &peer : peers) {
+                const std::size_t waiting = peer->held.size() -
+                    std::count(peer->held.begin(), peer->held.end(), peer->running);
+                if (peer.get() != &thief && !peer->dead && waiting > most) {
+                    victim = peer.get();
+                    most = waiting;
+                }
+            }
+            if (victim) {
+                int index = -1;
+                for (const int held : victim->held) {
+                    if (held != victim->running) {
+                        index = held;
+                    }
+                }
+                cancel(*victim, index);
+                assign(thief, index);
+                ++stats.stolen;
+                return;
+            }
+
+            // ---------------
+            // a copy of the tile started the longest ago, once it runs
+            // for far longer than the tiles done so far
+            const double usual = done_count ? done_seconds / done_count : 0;
+            int slowest = -1;
+            for (const std::unique_ptr <Peer> &peer : peers) {
+                const int index = peer->running;
+                if (index >= 0 && !tiles[index].done && tiles[index].holders == 1 &&
+                    (slowest < 0 || tiles[index].started < tiles[slowest].started)) {
+                    slowest = index;
+                }
+            }
+            if (slowest >= 0 && seconds(tiles[slowest].started) > std::max(4 * usual, 1.0)) {
+                assign(thief, slowest);
+                ++stats.backups;
+            }
+        }
+
+        void receive(Peer &peer)
+        {
+            if (!peer.inbox.fill(peer.socket)) {
+                peer.dead = true;
+                return;
+            }
+
+            wire::Message type;
+            std::vector <std::uint8_t> payload;
+            try {
+                while (peer.inbox.next(type, payload)) {
+                    wire::Reader in(payload.data(), payload.size());
+                    switch (type) {
+                        case wire::Hello:
+                        if (in.varint() != wire::VERSION) {
+                            peer.dead = true;
+                            return;
+                        }
+                        peer.ready = true;
+                        sendJob(peer);
+                        break;
+                        case wire::Start:
+                        if (in.varint() == job) {
+                            const std::uint64_t index = in.varint();
+                            if (index < tiles.size()) {
+                                peer.running = static_cast <int>(index);
+                                tiles[index].started = Clock::now();
+                            }
+                        }
+                        break;
+                        case wire::Done:
+                        if (in.varint() == job) {
+                            done(peer, in, payload.size());
+                        }
+                        break;
+                        default:
+                        throw std::runtime_error("wire: unexpected message\n");
+                    }
+                }
+            }
+            catch (std::exception &) {
+                // ---------------
+                // a worker that does not follow the protocol is dropped
+                peer.dead = true;
+            }
+        }
+
+        void done(Peer &peer, wire::Reader &in, const std::size_t size)
+        {
+            const std::uint64_t index = in.varint();
+            if (index >= tiles.size()) {
+                throw std::runtime_error("wire: no such tile\n");
+            }
+            TileState &tile = tiles[index];
+            const KernelStats kernel = wire::readStats(in);
+
+            if (tile.done) {
+                release(peer, static_cast <int>(index));
+                if (peer.running == static_cast <int>(index)) {
+                    peer.running = -1;
+                }
+                ++stats.duplicates;
+                return;
+            }
+
+            // ---------------
+            // read whole before the worker lets go of the tile: if it
+            // throws, the worker still holds it and bury() queues it again
+            const std::size_t pixels = static_cast <std::size_t>(tile.width) * tile.height;
+            std::vector <int> counts(pixels);
+            std::vector <float> magnitudes(pixels, 0.0f);
+            wire::readCounts(in, counts.data(), pixels);
+            for (std::size_t k = 0; k < pixels; ++k) {
+                if (counts[k] < 0 || counts[k] > current.iterations) {
+                    throw std::runtime_error("wire: count out of range\n");
+                }
+                if (distributed.magnitudes && counts[k] < current.iterations) {
+                    magnitudes[k] = in.real32();
+                }
+            }
+
+            release(peer, static_cast <int>(index));
+            if (peer.running == static_cast <int>(index)) {
+                peer.running = -1;
+            }
+
+            // ---------------
+            // into the frame, colored on the way
+            Frame &frame = *target;
+            for (int row = 0; row < tile.height; ++row) {
+                const std::size_t from = static_cast <std::size_t>(row) * tile.width,
+                                  to = static_cast <std::size_t>(tile.y0 + row) * frame.width + tile.x0;
+                std::copy_n(&counts[from], tile.width, &frame.iterations[to]);
+                std::copy_n(&magnitudes[from], tile.width, &frame.magnitudes[to]);
+                map->color(&frame.iterations[to], &frame.magnitudes[to], tile.width,
+                           &frame.rgba[to * 4]);
+            }
+
+            tile.done = true;
+            --remaining;
+            if (tile.started != Clock::time_point()) {
+                done_seconds += seconds(tile.started);
+                ++done_count;
+            }
+            stats.kernel += kernel;
+            stats.received_bytes += size;
+            stats.raw_bytes += pixels * (distributed.magnitudes ? 8 : 4);
+
+            for (const std::unique_ptr <Peer> &other : peers) {
+                if (other.get() != &peer) {
+                    cancel(*other, static_cast <int>(index));
+                }
+            }
+        }
+
+        // ------------------
+        // drops the dead workers; their tiles nobody else holds go back
+        // to the front of the queue
+        void bury()
+        {
+            for (std::size_t p = 0; p < peers.size(); ) {
+                Peer &peer = *peers[p];
+                if (!peer.dead) {
+                    ++p;
+                    continue;
+                }
+                for (auto held = peer.held.rbegin(); held != peer.held.rend(); ++held) {
+                    TileState &tile = tiles[*held];
+                    if (--tile.holders == 0 && !tile.done) {
+                        queue.push_front(*held);
+                        ++stats.requeued;
+                    }
+                }
+                peers.erase(peers.begin() + p);
+            }
+        }
+    };
+
+    // ------------------
+    // a worker: connects to the coordinator at host:port and renders
+    // the tiles it gets with threads threads until told to quit or
+    // disconnected
+    inline void runWorker(const std::string &address, const unsigned threads, const Isa isa)
+    {
+        const std::size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            throw std::runtime_error("Worker: the address is host:port\n");
+        }
+        Socket socket = Socket::connect(address.substr(0, colon),
+                                        std::atoi(address.c_str() + colon + 1));
+
+        wire::Writer hello;
+        hello.varint(wire::VERSION);
+        hello.varint(threads);
+        wire::send(socket, wire::Hello, hello);
+
+        struct TileOrder
+        {
+            std::uint64_t job, index;
+            int x0, y0, width, height;
+        };
+
+        // ---------------
+        // the messages are read on a thread of their own, so that
+        // cancellations reach the queue while a tile renders
+        std::mutex mutex;
+        std::condition_variable arrived;
+        std::deque <TileOrder> orders;
+        bool quit = false;
+        std::uint64_t job = 0;
+        View view;
+        RenderOptions options;
+        bool magnitudes = false;
+
+        std::thread reader([&]() {
+            wire::Inbox inbox;
+            wire::Message type;
+            std::vector <std::uint8_t> payload;
+            try {
+                while (inbox.fill(socket)) {
+                    while (inbox.next(type, payload)) {
+                        wire::Reader in(payload.data(), payload.size());
+                        std::lock_guard <std::mutex> lock(mutex);
+                        if (type == wire::Job) {
+                            job = in.varint();
+                            view = wire::readView(in);
+                            wire::readOptions(in, options);
+                            magnitudes = in.byte() != 0;
+                            orders.clear();
+                        }
+                        else if (type == wire::Tile) {
+                            TileOrder order;
+                            order.job = in.varint();
+                            order.index = in.varint();
+                            order.x0 = static_cast <int>(in.varint());
+                            order.y0 = static_cast <int>(in.varint());
+                            order.width = static_cast <int>(in.varint());
+                            order.height = static_cast <int>(in.varint());
+                            orders.push_back(order);
+                        }
+                        else if (type == wire::Cancel) {
+                            const std::uint64_t order_job = in.varint(),
+                                                index = in.varint();
+                            orders.erase(std::remove_if(orders.begin(), orders.end(),
+                                                        [&](const TileOrder &order) {
+                                return order.job == order_job && order.index == index;
+                            }), orders.end());
+                        }
+                        else if (type == wire::Quit) {
+                            quit = true;
+                        }
+                        arrived.notify_one();
+                        if (quit) {
+                            return;
+                        }
+                    }
+                }
+            }
+            catch (std::exception &) {
+            }
+            std::lock_guard <std::mutex> lock(mutex);
+            quit = true;
+            arrived.notify_one();
+        });
+
+        Renderer renderer(threads);
+        Frame frame;
+        try {
+            while (true) {
+                TileOrder order;
+                View tile;
+                bool send_magnitudes;
+                {
+                    std::unique_lock <std::mutex> lock(mutex);
+                    arrived.wait(lock, [&]() {
+                        return quit || !orders.empty();
+                    });
+                    if (quit) {
+                        break;
+                    }
+                    order = orders.front();
+                    orders.pop_front();
+                    if (order.job != job || order.x0 + order.width > view.width ||
+                        order.y0 + order.height > view.height) {
+                        continue;
+                    }
+                    renderer.renderOptions() = options;
+                    renderer.renderOptions().isa = isa;
+                    tile = regionOf(view, order.x0, order.y0, order.width, order.height);
+                    send_magnitudes = magnitudes;
+                }
+
+                wire::Writer start;
+                start.varint(order.job);
+                start.varint(order.index);
+                wire::send(socket, wire::Start, start);
+
+                renderer.render(tile, frame);
+
+                wire::Writer out;
+                out.varint(order.job);
+                out.varint(order.index);
+                wire::writeStats(out, renderer.lastStats());
+                wire::writeCounts(out, frame.iterations.data(), frame.iterations.size());
+                if (send_magnitudes) {
+                    for (std::size_t k = 0; k < frame.iterations.size(); ++k) {
+                        if (frame.iterations[k] < tile.iterations) {
+                            out.real32(frame.magnitudes[k]);
+                        }
+                    }
+                }
+                wire::send(socket, wire::Done, out);
+            }
+        }
+        catch (std::exception &) {
+            // ---------------
+            // the coordinator is gone
+        }
+
+        socket.shutdown();
+        reader.join();
+    }
+};
+
+#endif  //DISTRIBUTED_RENDERER_HPP
@@ -0,0 +1,240 @@
+/* Fixed point number with Limbs 32 bit limbs: one signed integer limb
+   followed by Limbs - 1 fractional ones, stored most significant first
+   in two's complement. It is only as fast as schoolbook arithmetic can
+   be, so it is used for the few values that really need the precision
+   (the perturbation reference orbit), never per pixel.*/
+
+#ifndef FIXED_POINT_HPP
+#define FIXED_POINT_HPP
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+template <int Limbs>
+class FixedPoint
+{
+    static_assert(Limbs >= 2, "FixedPoint needs at least one fractional limb");
+
+public:
+    // ------------------
+    // number of fractional bits
+    static constexpr int precision = 32 * (Limbs - 1);
+
+    FixedPoint()
+    {
+        limb.fill(0);
+    }
+
+    // ------------------
+    // exact for every double whose integer part fits in 31 bits
+    explicit FixedPoint(double value)
+    {
+        const bool negative = value < 0;
+        value = std::fabs(value);
+        if (value >= 2147483648.0) {
+            throw std::range_error("FixedPoint: value out of range\n");
+        }
+
+        double whole = std::floor(value);
+        limb[0] = static_cast <std::uint32_t>(whole);
+        for (int k = 1; k < Limbs; ++k) {
+            value = (value - whole) * 4294967296.0;
+            whole = std::floor(value);
+            limb[k] = static_cast <std::uint32_t>(whole);
+        }
+
+        if (negative) {
+            negate();
+        }
+    }
+
+    // ------------------
+    // decimal literal such as "-0.743643887037158704752191506114774",
+    // needed because deep zoom centers have more digits than a double
+    static FixedPoint fromString(const std::string &text)
+    {
+        std::size_t pos = 0;
+        const bool has_sign = !text.empty() && (text[0] == '-' || text[0] == '+');
+        const bool minus = has_sign && text[0] == '-';
+        if (has_sign) {
+            ++pos;
+        }
+
+        const std::size_t dot = text.find('.', pos);
+        const std::string whole = text.substr(pos, dot == std::string::npos ?
+                                                   std::string::npos : dot - pos);
+        const std::string fraction = dot == std::string::npos ?
+                                     std::string() : text.substr(dot + 1);
+
+        if (whole.empty() && fraction.empty()) {
+            throw std::invalid_argument("FixedPoint: empty number\n");
+        }
+
+        // -------------------
+        // the fractional digits are folded in from the last one:
+        // f = (digit + f) / 10 stays below one at every step
+        FixedPoint result;
+        for (auto it = fraction.rbegin(); it != fraction.rend(); ++it) {
+            result.limb[0] = static_cast <std::uint32_t>(digit(*it));
+            result.divideBy(10);
+        }
+
+        std::uint32_t integer = 0;
+        for (const char c : whole) {
+            integer = integer * 10 + static_cast <std::uint32_t>(digit(c));
+            if (integer >= 2147483648u) {
+                throw std::range_error("FixedPoint: value out of range\n");
+            }
+        }
+        result.limb[0] = integer;
+
+        if (minus) {
+            result.negate();
+        }
+        return result;
+    }
+
+    // ------------------
+    // conversion to any type built from doubles with + and unary -;
+    // every limb is exact as a double, so multi-double types get as
+    // many bits as they can hold
+    template <class Real>
+    Real to() const
+    {
+        FixedPoint magnitude = *this;
+        const bool negative = isNegative();
+        if (negative) {
+            magnitude.negate();
+        }
+
+        Real value = 0.0;
+        for (int k = Limbs - 1; k >= 0; --k) {
+            value = value + Real(std::ldexp(static_cast <double>(magnitude.limb[k]), -32 * k));
+        }
+        return negative ? -value : value;
+    }
+
+    double toDouble() const
+    {
+        return to <double>();
+    }
+
+    bool isNegative() const
+    {
+        return (limb[0] & 0x80000000u) != 0;
+    }
+
+    FixedPoint operator-() const
+    {
+        FixedPoint result = *this;
+        result.negate();
+        return result;
+    }
+
+    FixedPoint &operator+=(const FixedPoint &other)
+    {
+        std::uint64_t carry = 0;
+        for (int k = Limbs - 1; k >= 0; --k) {
+            carry += static_cast <std::uint64_t>(limb[k]) + other.limb[k];
+            limb[k] = static_cast <std::uint32_t>(carry);
+            carry >>= 32;
+        }
+        return *this;
+    }
+
+    FixedPoint &operator-=(const FixedPoint &other)
+    {
+        return *this += -other;
+    }
+
+    // ------------------
+    // the product of the magnitudes is truncated to the precision of
+    // the operands, then the sign is applied
+    FixedPoint &operator*=(const FixedPoint &other)
+    {
+        const bool negative = isNegative() != other.isNegative();
+        FixedPoint a = *this,
+                   b = other;
+        if (a.isNegative()) {
+            a.negate();
+        }
+        if (b.isNegative()) {
+            b.negate();
+        }
+
+        // -------------------
+        // little-endian double width product, only the limbs at or
+        // above the truncation point are kept
+        std::array <std::uint64_t, 2 * Limbs> product {};
+        for (int i = 0; i < Limbs; ++i) {
+            std::uint64_t carry = 0;
+            const std::uint64_t ai = a.limb[Limbs - 1 - i];
+            for (int j = 0; j < Limbs; ++j) {
+                carry += product[i + j] + ai * b.limb[Limbs - 1 - j];
+                product[i + j] = carry & 0xffffffffu;
+                carry >>= 32;
+            }
+            product[i + Limbs] = carry;
+        }
+
+        for (int k = 0; k < Limbs; ++k) {
+            limb[Limbs - 1 - k] = static_cast <std::uint32_t>(product[k + Limbs - 1]);
+        }
+
+        if (negative) {
+            negate();
+        }
+        return *this;
+    }
+
+    friend FixedPoint operator+(FixedPoint a, const FixedPoint &b)
+    {
+        return a += b;
+    }
+    friend FixedPoint operator-(FixedPoint a, const FixedPoint &b)
+    {
+        return a -= b;
+    }
+    friend FixedPoint operator*(FixedPoint a, const FixedPoint &b)
+    {
+        return a *= b;
+    }
+
+private:
+    std::array <std::uint32_t, Limbs> limb;
+
+    static int digit(const char c)
+    {
+        if (c < '0' || c > '9') {
+            throw std::invalid_argument(std::string("FixedPoint: unexpected '") + c + "'\n");
+        }
+        return c - '0';
+    }
+
+    void negate()
+    {
+        std::uint64_t carry = 1;
+        for (int k = Limbs - 1; k >= 0; --k) {
+            carry += static_cast <std::uint32_t>(~limb[k]);
+            limb[k] = static_cast <std::uint32_t>(carry);
+            carry >>= 32;
+        }
+    }
+
+    // ------------------
+    // long division of a non negative value
+    void divideBy(const std::uint32_t divisor)
+    {
+        std::uint64_t remainder = 0;
+        for (int k = 0; k < Limbs; ++k) {
+            remainder = (remainder << 32) | limb[k];
+            limb[k] = static_cast <std::uint32_t>(remainder / divisor);
+            remainder %= divisor;
+        }
+    }
+};
+
+#endif  //FIXED_POINT_HPP
@@ -0,0 +1,111 @@
+/* Variants of the iteration of mandelbrot.fs: the formula (Mandelbrot,
+   Burning Ship, or a Julia set of a fixed c), the exponent of z and the
+   coloring (bands of whole iteration counts, or smooth). The shader
+   gets a variant as preprocessor definitions and the CPU as template
+   arguments of its kernel (variant_kernel.hpp), so every variant is a
+   loop of its own, with no branch on the variant inside.
+
+   z^2 + c, banded or smooth, stays with the vectorized kernels of
+   simd_kernel.hpp, which take the escape radius of smooth coloring
+   too; the default variant is its banded version.*/
+
+#ifndef FRACTAL_VARIANT_HPP
+#define FRACTAL_VARIANT_HPP
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum class Formula {Mandelbrot, BurningShip, Julia};
+
+struct FractalVariant
+{
+    // ------------------
+    // exponents variant kernels are compiled for
+    static constexpr int MIN_POWER = 2,
+                         MAX_POWER = 5;
+
+    Formula formula = Formula::Mandelbrot;
+    int power = 2;
+    bool smooth = false;
+    // c of the Julia set
+    double julia_re = -0.8,
+           julia_im = 0.156;
+
+    // ------------------
+    // |z| past which a point escapes; smooth coloring wants a large one
+    double escapeRadius() const
+    {
+        return smooth ? 256 : 2;
+    }
+
+    bool isDefault() const
+    {
+        return isPlainMandelbrot() && !smooth;
+    }
+
+    // ------------------
+    // z^2 + c, which the vectorized kernels run
+    bool isPlainMandelbrot() const
+    {
+        return formula == Formula::Mandelbrot && power == 2;
+    }
+
+    friend bool operator==(const FractalVariant &a, const FractalVariant &b)
+    {
+        return a.formula == b.formula && a.power == b.power && a.smooth == b.smooth &&
+               (a.formula != Formula::Julia ||
+                (a.julia_re == b.julia_re && a.julia_im == b.julia_im));
+    }
+
+    friend bool operator!=(const FractalVariant &a, const FractalVariant &b)
+    {
+        return !(a == b);
+    }
+
+    static const char *formulaName(const Formula formula)
+    {
+        switch (formula) {
+            case Formula::BurningShip:
+            return "burning-ship";
+            case Formula::Julia:
+            return "julia";
+            default:
+            return "mandelbrot";
+        }
+    }
+
+    // ------------------
+    // equal for variants that compile to the same code
+    std::string key() const
+    {
+        std::string text = formulaName(formula);
+        text += " z^" + std::to_string(power) + (smooth ? " smooth" : " bands");
+        if (formula == Formula::Julia) {
+            char c[64];
+            std::snprintf(c, sizeof(c), " c=%.17g%+.17gi", julia_re, julia_im);
+            text += c;
+        }
+        return text;
+    }
+
+    // ------------------
+    // the definitions mandelbrot.fs reads, to put after its #version
+    std::vector <std::string> defines() const
+    {
+        std::vector <std::string> lines;
+        lines.push_back("FORMULA " + std::to_string(static_cast <int>(formula)));
+        lines.push_back("POWER " + std::to_string(power));
+        if (formula == Formula::Julia) {
+            char c[96];
+            std::snprintf(c, sizeof(c), "JULIA_C vec2(%.9g, %.9g)", julia_re, julia_im);
+            lines.push_back(c);
+        }
+        if (smooth) {
+            lines.push_back("SMOOTH");
+        }
+        return lines;
+    }
+};
+
+#endif  //FRACTAL_VARIANT_HPP
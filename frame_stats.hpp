@@ -0,0 +1,301 @@
+/* Timings of the frames of the interactive program, kept for the last
+   few seconds in a ring buffer.
+   The main loop marks where each of its phases starts; a phase lasts
+   until the next mark or the end of the frame, and may come up more
+   than once in a frame. Frames drawn on the CPU also keep the time of
+   every tile on every worker, the iterations they ran and how many
+   pixels are known to escape or to be inside.
+
+   GL calls only queue work, so the draw phase is the time spent
+   submitting it; the GPU catches up in the swap.
+
+   summary() is the text of the stats overlay; writeTrace() saves the
+   buffer as a Chrome trace (chrome://tracing, or ui.perfetto.dev), the
+   phases on the main thread and the tiles on one track per worker.*/
+
+#ifndef FRAME_STATS_HPP
+#define FRAME_STATS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "incremental_renderer.hpp"
+
+class FrameStats
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum Phase {Input, Uniforms, Render, Upload, Draw, Swap};
+    static constexpr int PHASES = 6;
+
+    static const char *phaseName(const Phase phase)
+    {
+        static const char *names[PHASES] = {"input", "uniforms", "render", "upload", "draw", "swap"};
+        return names[phase];
+    }
+
+    struct PhaseTime
+    {
+        Phase phase;
+        Clock::time_point start;
+        double seconds;
+    };
+
+    struct Record
+    {
+        std::uint64_t number = 0;
+        Clock::time_point start;
+        double seconds = 0;
+        std::vector <PhaseTime> phases;
+
+        // ---------------
+        // filled for frames drawn on the CPU only
+        bool cpu = false;
+        unsigned threads = 0;
+        std::vector <CPU::TileTime> tiles;
+        std::uint64_t iterations = 0;
+        std::size_t escaped = 0,
+                    interior = 0;
+
+        double phaseSeconds(const Phase phase) const
+        {
+            double sum = 0;
+            for (const PhaseTime &p : phases) {
+                sum += p.phase == phase ? p.seconds : 0;
+            }
+            return sum;
+        }
+    };
+
+    explicit FrameStats(const std::size_t capacity = 600)
+        : records(std::max <std::size_t>(capacity, 1)), origin(Clock::now())
+    {}
+
+    void beginFrame()
+    {
+        current.number = frames;
+        current.start = Clock::now();
+        current.phases.clear();
+        current.cpu = false;
+        current.threads = 0;
+        current.tiles.clear();
+        current.iterations = 0;
+        current.escaped = 0;
+        current.interior = 0;
+        in_phase = false;
+    }
+
+    // ---------------
+    // the given phase starts now, the one before ends
+    void phase(const Phase phase)
+    {
+        const Clock::time_point now = Clock::now();
+        closePhase(now);
+        current.phases.push_back(PhaseTime {phase, now, 0});
+        in_phase = true;
+    }
+
+    void cpuWork(const CPU::IncrementalStats &stats, const unsigned threads)
+    {
+        current.cpu = true;
+        current.threads = threads;
+        current.tiles.insert(current.tiles.end(), stats.tiles.begin(), stats.tiles.end());
+        current.iterations += stats.kernel.iterations;
+        current.escaped = stats.escaped;
+        current.interior = stats.interior;
+    }
+
+    void endFrame()
+    {
+        const Clock::time_point now = Clock::now();
+        closePhase(now);
+        current.seconds = seconds(current.start, now);
+
+        std::swap(records[frames % records.size()], current);
+        ++frames;
+    }
+
+    // ---------------
+    // frames in the buffer; record(0) is the last one
+    std::size_t size() const
+    {
+        return static_cast <std::size_t>(std::min <std::uint64_t>(frames, records.size()));
+    }
+
+    const Record &record(const std::size_t age) const
+    {
+        if (age >= size()) {
+            throw std::out_of_range("FrameStats: no such frame\n");
+        }
+        return records[(frames - 1 - age) % records.size()];
+    }
+
+    // ---------------
+    // one line: frame rate and mean phase times over the last frames,
+    // and the CPU work of the last one if it was drawn on the CPU
+    std::string summary(const std::size_t last_frames = 30) const
+    {
+        const std::size_t n = std::min(last_frames, size());
+        if (n == 0) {
+            return "";
+        }
+
+        double total = 0,
+               phase_totals[PHASES] = {};
+        for (std::size_t age = 0; age < n; ++age) {
+            const Record &r = record(age);
+            total += r.seconds;
+            for (int p = 0; p < PHASES; ++p) {
+                phase_totals[p] += r.phaseSeconds(static_cast <Phase>(p));
+            }
+        }
+
+        char text[256];
+        std::snprintf(text, sizeof(text), "%.1f fps |", total > 0 ? n / total : 0.0);
+        std::string line = text;
+        for (int p = 0; p < PHASES; ++p) {
+            std::snprintf(text, sizeof(text), " %s %.2f", phaseName(static_cast <Phase>(p)),
+                          phase_totals[p] / n * 1e3);
+            line += text;
+        }
+        line += " ms";
+
+        const Record &last = record(0);
+        if (last.cpu) {
+            std::vector <double> busy(std::max(last.threads, 1u), 0);
+            for (const CPU::TileTime &tile : last.tiles) {
+                if (tile.worker < busy.size()) {
+                    busy[tile.worker] += tile.seconds;
+                }
+            }
+            const auto range = std::minmax_element(busy.begin(), busy.end());
+            const double pixels = std::max <double>(last.escaped + last.interior, 1);
+
+            std::snprintf(text, sizeof(text),
+                          " | %zu tiles on %u threads, busy %.1f-%.1f ms | %.2f Mit,"
+                          " %.0f%% escaped, %.0f%% inside",
+                          last.tiles.size(), last.threads, *range.first * 1e3,
+                          *range.second * 1e3, last.iterations / 1e6,
+                          100.0 * last.escaped / pixels, 100.0 * last.interior / pixels);
+            line += text;
+        }
+        return line;
+    }
+
+    // ---------------
+    // Chrome trace event format: complete events in microseconds,
+    // main thread on tid 0 and worker w on tid w + 1
+    void writeTrace(const std::string &path) const
+    {
+        std::ofstream out(path);
+        if (!out) {
+            throw std::runtime_error("Cannot open " + path + " for writing\n");
+        }
+
+        char event[256];
+        bool first = true;
+        const auto emit = [&]() {
+            out << (first ? "\n" : ",\n") << event;
+            first = false;
+        };
+
+        unsigned workers = 0;
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+        for (std::size_t age = size(); age-- > 0;) {
+            const Record &r = record(age);
+
+            std::snprintf(event, sizeof(event),
+                          "{\"name\": \"frame %llu\", \"cat\": \"frame\", \"ph\": \"X\", \"pid\": 1,"
+                          " \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f}",
+                          static_cast <unsigned long long>(r.number),
+                          micro(r.start), r.seconds * 1e6);
+            emit();
+
+            for (const PhaseTime &p : r.phases) {
+                std::snprintf(event, sizeof(event),
+                              "{\"name\": \"%s\", \"cat\": \"phase\", \"ph\": \"X\", \"pid\": 1,"
+                              " \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f}",
+                              phaseName(p.phase), micro(p.start), p.seconds * 1e6);
+                emit();
+            }
+
+            if (!r.cpu) {
+                continue;
+            }
+            workers = std::max(workers, r.threads);
+
+            for (const CPU::TileTime &tile : r.tiles) {
+                std::snprintf(event, sizeof(event),
+                              "{\"name\": \"tile\", \"cat\": \"cpu\", \"ph\": \"X\", \"pid\": 1,"
+                              " \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                              tile.worker + 1, micro(tile.start), tile.seconds * 1e6);
+                emit();
+            }
+
+            std::snprintf(event, sizeof(event),
+                          "{\"name\": \"pixels\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f,"
+                          " \"args\": {\"escaped\": %zu, \"inside\": %zu}}",
+                          micro(r.start), r.escaped, r.interior);
+            emit();
+            std::snprintf(event, sizeof(event),
+                          "{\"name\": \"iterations\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f,"
+                          " \"args\": {\"iterations\": %llu}}",
+                          micro(r.start), static_cast <unsigned long long>(r.iterations));
+            emit();
+        }
+
+        std::snprintf(event, sizeof(event),
+                      "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0,"
+                      " \"args\": {\"name\": \"main\"}}");
+        emit();
+        for (unsigned w = 0; w < workers; ++w) {
+            std::snprintf(event, sizeof(event),
+                          "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u,"
+                          " \"args\": {\"name\": \"worker %u%s\"}}",
+                          w + 1, w, w == 0 ? " (main thread)" : "");
+            emit();
+        }
+        out << "\n]}\n";
+
+        if (!out) {
+            throw std::runtime_error("Cannot write " + path + "\n");
+        }
+    }
+
+private:
+    std::vector <Record> records;
+    std::uint64_t frames = 0;
+    Record current;
+    bool in_phase = false;
+    Clock::time_point origin;
+
+    static double seconds(const Clock::time_point from, const Clock::time_point to)
+    {
+        return std::chrono::duration <double>(to - from).count();
+    }
+
+    double micro(const Clock::time_point time) const
+    {
+        return seconds(origin, time) * 1e6;
+    }
+
+    void closePhase(const Clock::time_point now)
+    {
+        if (in_phase) {
+            current.phases.back().seconds = seconds(current.phases.back().start, now);
+            in_phase = false;
+        }
+    }
+};
+
+#endif  //FRAME_STATS_HPP
@@ -0,0 +1,215 @@
+/* Image writers that take the picture a few rows at a time, so that
+   an image of any size can be written while only one band of it is in
+   memory. The format follows the extension of the file: .png is
+   compressed with zlib as the rows come in, anything else is written
+   as a binary PPM.*/
+
+#ifndef IMAGE_WRITER_HPP
+#define IMAGE_WRITER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+class ImageWriter
+{
+public:
+    virtual ~ImageWriter() = default;
+
+    // ------------------
+    // the next rows of RGBA8 pixels, top first; alpha is dropped
+    virtual void writeRows(const std::uint8_t *rgba, int rows) = 0;
+
+    // ------------------
+    // to be called once all rows are written
+    virtual void finish() = 0;
+
+    static std::unique_ptr <ImageWriter> open(const std::string &path, int width, int height);
+
+protected:
+    ImageWriter(const std::string &path, const int w, const int h)
+        : out(path, std::ios::binary), width(w), height(h)
+    {
+        if (!out) {
+            throw std::runtime_error("Cannot open " + path + " for writing\n");
+        }
+    }
+
+    std::ofstream out;
+    int width,
+        height;
+};
+
+class PPMWriter : public ImageWriter
+{
+public:
+    PPMWriter(const std::string &path, const int w, const int h)
+        : ImageWriter(path, w, h), rgb(static_cast <std::size_t>(w) * 3)
+    {
+        out << "P6\n" << width << ' ' << height << "\n255\n";
+    }
+
+    void writeRows(const std::uint8_t *rgba, const int rows) override
+    {
+        for (int row = 0; row < rows; ++row) {
+            for (int x = 0; x < width; ++x) {
+                const std::uint8_t *pixel = rgba + (static_cast <std::size_t>(row) * width + x) * 4;
+                rgb[x * 3] = pixel[0];
+                rgb[x * 3 + 1] = pixel[1];
+                rgb[x * 3 + 2] = pixel[2];
+            }
+            out.write(reinterpret_cast <const char *>(rgb.data()), rgb.size());
+        }
+    }
+
+    void finish() override
+    {
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("PPMWriter: write failed\n");
+        }
+    }
+
+private:
+    std::vector <std::uint8_t> rgb;
+};
+
+// ------------------
+// 8 bit RGB, each row filtered with Sub (the difference from the
+// pixel on the left, which is small on smooth color bands) and
+// deflated into IDAT chunks as soon as the compressor lets them out
+class PNGWriter : public ImageWriter
+{
+public:
+    PNGWriter(const std::string &path, const int w, const int h)
+        : ImageWriter(path, w, h),
+          row_bytes(static_cast <std::size_t>(w) * 3 + 1),
+          filtered(row_bytes),
+          compressed(1 << 16)
+    {
+        stream.zalloc = Z_NULL;
+        stream.zfree = Z_NULL;
+        stream.opaque = Z_NULL;
+        if (deflateInit(&stream, 6) != Z_OK) {
+            throw std::runtime_error("PNGWriter: cannot initialize zlib\n");
+        }
+
+        static const unsigned char signature[] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+        out.write(reinterpret_cast <const char *>(signature), sizeof(signature));
+
+        unsigned char header[13];
+        putBigEndian(header, static_cast <std::uint32_t>(width));
+        putBigEndian(header + 4, static_cast <std::uint32_t>(height));
+        header[8] = 8;   // bits per channel
+        header[9] = 2;   // RGB
+        header[10] = 0;  // deflate
+        header[11] = 0;  // adaptive filtering
+        header[12] = 0;  // not interlaced
+        chunk("IHDR", header, sizeof(header));
+    }
+
+    ~PNGWriter()
+    {
+        deflateEnd(&stream);
+    }
+
+    void writeRows(const std::uint8_t *rgba, const int rows) override
+    {
+        for (int row = 0; row < rows; ++row) {
+            const std::uint8_t *pixels = rgba + static_cast <std::size_t>(row) * width * 4;
+
+            filtered[0] = 1;  // Sub
+            for (int x = 0; x < width; ++x) {
+                for (int c = 0; c < 3; ++c) {
+                    const std::uint8_t left = x > 0 ? pixels[(x - 1) * 4 + c] : 0;
+                    filtered[1 + x * 3 + c] = static_cast <std::uint8_t>(pixels[x * 4 + c] - left);
+                }
+            }
+            compress(filtered.data(), row_bytes, Z_NO_FLUSH);
+        }
+    }
+
+    void finish() override
+    {
+        compress(nullptr, 0, Z_FINISH);
+        chunk("IEND", nullptr, 0);
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("PNGWriter: write failed\n");
+        }
+    }
+
+private:
+    z_stream stream;
+    std::size_t row_bytes;
+    std::vector <std::uint8_t> filtered,
+                               compressed;
+
+    static void putBigEndian(unsigned char *bytes, const std::uint32_t value)
+    {
+        bytes[0] = static_cast <unsigned char>(value >> 24);
+        bytes[1] = static_cast <unsigned char>(value >> 16);
+        bytes[2] = static_cast <unsigned char>(value >> 8);
+        bytes[3] = static_cast <unsigned char>(value);
+    }
+
+    void chunk(const char *type, const unsigned char *data, const std::size_t size)
+    {
+        unsigned char length[4], crc[4];
+        putBigEndian(length, static_cast <std::uint32_t>(size));
+
+        uLong sum = crc32(0, reinterpret_cast <const Bytef *>(type), 4);
+        if (size) {
+            sum = crc32(sum, data, static_cast <uInt>(size));
+        }
+        putBigEndian(crc, static_cast <std::uint32_t>(sum));
+
+        out.write(reinterpret_cast <const char *>(length), 4);
+        out.write(type, 4);
+        out.write(reinterpret_cast <const char *>(data), size);
+        out.write(reinterpret_cast <const char *>(crc), 4);
+    }
+
+    // ------------------
+    // every full output buffer becomes an IDAT chunk
+    void compress(const std::uint8_t *data, const std::size_t size, const int flush)
+    {
+        stream.next_in = const_cast <Bytef *>(data);
+        stream.avail_in = static_cast <uInt>(size);
+
+        int status;
+        do {
+            stream.next_out = compressed.data();
+            stream.avail_out = static_cast <uInt>(compressed.size());
+            status = deflate(&stream, flush);
+            if (status == Z_STREAM_ERROR) {
+                throw std::runtime_error("PNGWriter: deflate failed\n");
+            }
+
+            const std::size_t produced = compressed.size() - stream.avail_out;
+            if (produced) {
+                chunk("IDAT", compressed.data(), produced);
+            }
+        } while (stream.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+    }
+};
+
+inline std::unique_ptr <ImageWriter> ImageWriter::open(const std::string &path, const int width,
+                                                       const int height)
+{
+    const std::size_t dot = path.rfind('.');
+    const std::string extension = dot == std::string::npos ? std::string() : path.substr(dot);
+
+    if (extension == ".png" || extension == ".PNG") {
+        return std::unique_ptr <ImageWriter>(new PNGWriter(path, width, height));
+    }
+    return std::unique_ptr <ImageWriter>(new PPMWriter(path, width, height));
+}
+
+#endif  //IMAGE_WRITER_HPP
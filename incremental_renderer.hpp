@@ -0,0 +1,557 @@
+/* CPU renderer for interactive navigation. It keeps, for every pixel
+   of the last frame, its iteration count and the last z of its orbit,
+   so that the next frame only iterates what it cannot reuse:
+
+   - panning moves the center by a whole number of pixels (the view
+     center is snapped to the pixel grid of the stored frame), the
+     pixels still on screen are shifted over and only the exposed
+     strips are iterated;
+   - raising the iteration cap continues the orbits that had not
+     escaped from their stored z instead of starting them at zero,
+     lowering it only clamps the stored counts.
+
+   Any other change (zoom, size, precision, variant) starts from an
+   empty buffer. Counts are those of the plain loop, like the other
+   renderers. Variants other than the default one keep no z, so their
+   undecided pixels are iterated again from zero when the cap rises.
+
+   refine() spreads the same work over several frames. A pass first
+   samples one pixel out of COARSE_STEP x COARSE_STEP with at most
+   COARSE_ITERATIONS iterations, the next passes halve the spacing, then
+   the cap is doubled until it reaches the one of the view. Passes stop
+   once the time budget is spent and the next call picks up where the
+   last one stopped; the pixels not sampled yet show the closest coarser
+   sample, the undecided ones show as inside the set.*/
+
+#ifndef INCREMENTAL_RENDERER_HPP
+#define INCREMENTAL_RENDERER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <variant>
+#include <vector>
+
+#include "cpu_renderer.hpp"
+#include "multi_double.hpp"
+#include "simd_kernel.hpp"
+#include "thread_pool.hpp"
+#include "variant_kernel.hpp"
+
+namespace CPU
+{
+    // ------------------
+    // one tile of one pass, on one worker of the pool
+    struct TileTime
+    {
+        unsigned worker;
+        std::chrono::steady_clock::time_point start;
+        double seconds;
+    };
+
+    struct IncrementalStats
+    {
+        // pixels taken over from the previous frame
+        std::size_t reused = 0;
+        // pixels iterated from scratch
+        std::size_t computed = 0;
+        // orbits continued for a higher iteration cap
+        std::size_t resumed = 0;
+        // pixels of the frame known to escape, and known to reach the
+        // cap; the others are not decided yet
+        std::size_t escaped = 0,
+                    interior = 0;
+        KernelStats kernel;
+        std::vector <TileTime> tiles;
+    };
+
+    class IncrementalRenderer
+    {
+    public:
+        explicit IncrementalRenderer(ThreadPool &thread_pool,
+                                     const RenderOptions &opts = RenderOptions())
+            : pool(thread_pool), options(opts)
+        {}
+
+        RenderOptions &renderOptions()
+        {
+            return options;
+        }
+
+        const IncrementalStats &lastStats() const
+        {
+            return stats;
+        }
+
+        // --------------------
+        // view of the last frame, with its center on the pixel grid
+        View lastView() const
+        {
+            const double step = 2 / (grid.zoom * grid.height);
+            View view = grid;
+            view.cx += QuadDouble(grid_x * step);
+            view.cy += QuadDouble(grid_y * step);
+            return view;
+        }
+
+        // --------------------
+        // forgets the stored frame, the next one starts from scratch
+        void invalidate()
+        {
+            valid = false;
+        }
+
+        // --------------------
+        // renders view in the precision of the options; the frame is
+        // centered on the closest point of the pixel grid, less than
+        // half a pixel away from the requested center
+        void render(const View &view, Frame &frame)
+        {
+            renderWithin(view, frame, 0);
+        }
+
+        // --------------------
+        // as render(), but returns once about budget_ms milliseconds
+        // are spent, with a frame that may still be partial (a budget
+        // of 0 does it all at once). Returns true when the frame is
+        // complete.
+        bool refine(const View &view, Frame &frame, const double budget_ms)
+        {
+            return renderWithin(view, frame, std::max(budget_ms, 0.0));
+        }
+
+    private:
+        enum State : std::uint8_t {Unknown, Escaped, Bounded};
+
+        using Clock = std::chrono::steady_clock;
+
+        // -----------------
+        // first pass of refine(), a power of two
+        static constexpr int COARSE_STEP = 8,
+                             COARSE_ITERATIONS = 64;
+
+        ThreadPool &pool;
+        RenderOptions options;
+        IncrementalStats stats;
+
+        // -----------------
+        // the pixel grid: the view it started from and how many pixels
+        // the center has moved since. Points are always computed from
+        // that first center, so a pixel does not depend on the way the
+        // view got to it.
+        View grid;
+        long long grid_x = 0,
+                  grid_y = 0;
+
+        // -----------------
+        // per pixel: a count and its meaning. Escaped pixels hold their
+        // escape time, Bounded ones the number of iterations they have
+        // completed, with z after the last of them in zr / zi.
+        Precision precision = Precision::Float;
+        FractalVariant variant;
+        bool valid = false;
+        std::vector <int> counts;
+        std::vector <std::uint8_t> states;
+        // |z| where escaped pixels escaped, for smooth coloring
+        std::vector <float> magnitudes;
+        std::variant <std::vector <float>, std::vector <double>,
+                      std::vector <DoubleDouble>, std::vector <QuadDouble>> zr, zi;
+
+        // -----------------
+        // first pass of refine() not done yet for the stored frame
+        int next_pass = 0;
+
+        // -----------------
+        // a budget of 0 means no budget and a single full pass
+        bool renderWithin(const View &view, Frame &frame, const double budget_ms)
+        {
+            switch (options.precision) {
+                case Precision::Double:
+                return renderAs <double>(view, frame, budget_ms);
+                case Precision::DoubleDouble:
+                return renderAs <DoubleDouble>(view, frame, budget_ms);
+                case Precision::QuadDouble:
+                return renderAs <QuadDouble>(view, frame, budget_ms);
+                default:
+                return renderAs <float>(view, frame, budget_ms);
+            }
+        }
+
+        // -----------------
+        // spacing and iteration cap of the pass of refine() with the
+        // given index; passes() is their number
+        static void passOf(const int index, const int cap, int &step, int &stage)
+        {
+            const int coarse = std::min(cap, COARSE_ITERATIONS);
+            step = COARSE_STEP >> std::min(index, levels() - 1);
+            stage = coarse;
+            for (int k = levels() - 1; k < index && stage < cap; ++k) {
+                stage = stage > cap / 2 ? cap : stage * 2;
+            }
+        }
+
+        static int passes(const int cap)
+        {
+            int count = levels();
+            for (int stage = std::min(cap, COARSE_ITERATIONS); stage < cap; ++count) {
+                stage = stage > cap / 2 ? cap : stage * 2;
+            }
+            return count;
+        }
+
+        static constexpr int levels()
+        {
+            int count = 1;
+            for (int step = COARSE_STEP; step > 1; step /= 2) {
+                ++count;
+            }
+            return count;
+        }
+
+        template <class Real>
+        bool renderAs(const View &view, Frame &frame, const double budget_ms)
+        {
+            using Buffer = std::vector <Real>;
+
+            const Clock::time_point deadline = Clock::now() +
+                std::chrono::duration_cast <Clock::duration>(
+                    std::chrono::duration <double, std::milli>(budget_ms));
+
+            const std::size_t size = static_cast <std::size_t>(view.width) * view.height;
+            const double step = 2 / (view.zoom * view.height);
+            double pixel_x = 0,
+                   pixel_y = 0;
+
+            bool reuse = valid && precision == options.precision && variant == options.variant &&
+                         grid.width == view.width && grid.height == view.height &&
+                         grid.zoom == view.zoom;
+            if (reuse) {
+                pixel_x = std::round((view.cx - grid.cx).toDouble() / step);
+                pixel_y = std::round((view.cy - grid.cy).toDouble() / step);
+                reuse = std::fabs(pixel_x - grid_x) < view.width &&
+                        std::fabs(pixel_y - grid_y) < view.height &&
+                        std::fabs(pixel_x) < 1e15 && std::fabs(pixel_y) < 1e15;
+            }
+
+            if (reuse) {
+                const int dx = static_cast <int>(pixel_x - grid_x),
+                          dy = static_cast <int>(pixel_y - grid_y);
+                if (dx || dy || grid.iterations != view.iterations) {
+                    next_pass = 0;
+                }
+                if (dx || dy) {
+                    grid_x += dx;
+                    grid_y += dy;
+                    shift(counts, dx, dy, 0);
+                    shift(states, dx, dy, static_cast <std::uint8_t>(Unknown));
+                    shift(std::get <Buffer>(zr), dx, dy, Real(0));
+                    shift(std::get <Buffer>(zi), dx, dy, Real(0));
+                    shift(magnitudes, dx, dy, 0.0f);
+                }
+            }
+            else {
+                grid = view;
+                grid_x = 0;
+                grid_y = 0;
+                precision = options.precision;
+                variant = options.variant;
+                counts.assign(size, 0);
+                states.assign(size, Unknown);
+                magnitudes.assign(size, 0.0f);
+                zr = Buffer(size);
+                zi = Buffer(size);
+                valid = true;
+                next_pass = 0;
+            }
+            grid.iterations = view.iterations;
+
+            const Kernel <Real> kernel = kernelFor <Real>(options.isa,
+                                                          options.interior_checks,
+                                                          variant.smooth);
+            const VariantKernel <Real> variant_kernel =
+                variant.isPlainMandelbrot() ? nullptr : variantKernelFor <Real>(variant);
+            std::vector <IncrementalStats> worker_stats(pool.size());
+            std::atomic <bool> late {false};
+
+            const int tile = std::max(options.tile_size, 1),
+                      tiles_x = (view.width + tile - 1) / tile,
+                      tiles_y = (view.height + tile - 1) / tile;
+            const std::size_t tiles = static_cast <std::size_t>(tiles_x) * tiles_y;
+
+            const auto bounds = [&](const std::size_t index, int &x0, int &y0, int &x1, int &y1) {
+                x0 = static_cast <int>(index % tiles_x) * tile;
+                y0 = static_cast <int>(index / tiles_x) * tile;
+                x1 = std::min(x0 + tile, view.width);
+                y1 = std::min(y0 + tile, view.height);
+            };
+
+            const auto pass = [&](const int step, const int stage) {
+                pool.run(tiles, [&](const std::size_t index, const unsigned worker) {
+                    const Clock::time_point start = Clock::now();
+                    int x0, y0, x1, y1;
+                    bounds(index, x0, y0, x1, y1);
+                    iterateTile(kernel, variant_kernel, x0, y0, x1, y1, step, stage,
+                                budget_ms > 0 ? &deadline : nullptr, late,
+                                worker_stats[worker]);
+                    worker_stats[worker].tiles.push_back(TileTime {worker, start,
+                        std::chrono::duration <double>(Clock::now() - start).count()});
+                });
+            };
+
+            const std::size_t reused = size - std::count(states.begin(), states.end(),
+                                                         static_cast <std::uint8_t>(Unknown));
+            const int pass_count = passes(view.iterations);
+
+            if (budget_ms > 0) {
+                while (next_pass < pass_count && Clock::now() < deadline) {
+                    int step, stage;
+                    passOf(next_pass, view.iterations, step, stage);
+                    pass(step, stage);
+                    if (late) {
+                        break;
+                    }
+                    ++next_pass;
+                }
+            }
+            else if (next_pass < pass_count) {
+                pass(1, view.iterations);
+                next_pass = pass_count;
+            }
+
+            frame.resize(view.width, view.height);
+            pool.run(tiles, [&](const std::size_t index, unsigned) {
+                int x0, y0, x1, y1;
+                bounds(index, x0, y0, x1, y1);
+                composeTile(frame, x0, y0, x1, y1);
+            });
+
+            stats = IncrementalStats();
+            stats.reused = reused;
+            for (const IncrementalStats &s : worker_stats) {
+                stats.computed += s.computed;
+                stats.resumed += s.resumed;
+                stats.kernel += s.kernel;
+                stats.tiles.insert(stats.tiles.end(), s.tiles.begin(), s.tiles.end());
+            }
+            for (std::size_t p = 0; p < size; ++p) {
+                stats.escaped += states[p] == Escaped;
+                stats.interior += states[p] == Bounded && counts[p] >= view.iterations;
+            }
+            return next_pass == pass_count;
+        }
+
+        // -----------------
+        // brings the pixels of the tile that lie on the grid of the
+        // given spacing up to cap iterations: unknown ones of a row go
+        // through the kernel as one batch, bounded ones short of cap
+        // are continued one by one (with a variant kernel, they join
+        // the batch). Past the deadline, if there is one, the remaining
+        // rows are left for later and late is set.
+        template <class Real>
+        void iterateTile(const Kernel <Real> kernel, const VariantKernel <Real> variant_kernel,
+                         const int x0, const int y0,
+                         const int x1, const int y1, const int step, const int cap,
+                         const Clock::time_point *deadline, std::atomic <bool> &late,
+                         IncrementalStats &tile_stats)
+        {
+            using Buffer = std::vector <Real>;
+
+            Buffer &z_re = std::get <Buffer>(zr),
+                   &z_im = std::get <Buffer>(zi);
+            const int first_x = x0 + gridPhase(x0 + grid_x, step);
+
+            std::vector <Real> cr, ci, batch_zr(x1 - x0), batch_zi(x1 - x0);
+            std::vector <std::size_t> batch;
+            std::vector <int> batch_counts(x1 - x0);
+            std::vector <float> batch_magnitudes(x1 - x0);
+
+            for (int row = y0 + gridPhase(y0 - grid_y, step); row < y1; row += step) {
+                if (deadline && Clock::now() > *deadline) {
+                    late = true;
+                    return;
+                }
+
+                const Real im = pointOf <Real>(grid.cy, grid.offsetIm(row - grid_y));
+                const std::size_t first = static_cast <std::size_t>(row) * grid.width;
+
+                cr.clear();
+                ci.clear();
+                batch.clear();
+
+                for (int x = first_x; x < x1; x += step) {
+                    const std::size_t p = first + x;
+
+                    if (states[p] == Unknown ||
+                        (variant_kernel && states[p] == Bounded && counts[p] < cap)) {
+                        cr.push_back(pointOf <Real>(grid.cx, grid.offsetRe(x + grid_x)));
+                        ci.push_back(im);
+                        batch.push_back(p);
+                    }
+                    else if (states[p] == Bounded && counts[p] < cap) {
+                        const int i = resume(pointOf <Real>(grid.cx, grid.offsetRe(x + grid_x)), im,
+                                             z_re[p], z_im[p], counts[p], cap,
+                                             tile_stats.kernel);
+                        states[p] = i < cap ? Escaped : Bounded;
+                        counts[p] = i;
+                        if (i < cap) {
+                            storeMagnitudes(&z_re[p], &z_im[p], &i, 1, cap, &magnitudes[p]);
+                        }
+                        ++tile_stats.resumed;
+                    }
+                }
+
+                if (!batch.empty()) {
+                    const int n = static_cast <int>(batch.size());
+                    if (variant_kernel) {
+                        variant_kernel(cr.data(), ci.data(), n, cap, variant, batch_counts.data(),
+                                       batch_magnitudes.data(), tile_stats.kernel);
+                    }
+                    else {
+                        kernel(cr.data(), ci.data(), n, cap, batch_counts.data(),
+                               batch_zr.data(), batch_zi.data(), tile_stats.kernel);
+                        storeMagnitudes(batch_zr.data(), batch_zi.data(), batch_counts.data(), n,
+                                        cap, batch_magnitudes.data());
+                    }
+
+                    for (int k = 0; k < n; ++k) {
+                        const std::size_t p = batch[k];
+                        counts[p] = batch_counts[k];
+                        states[p] = batch_counts[k] < cap ? Escaped : Bounded;
+                        magnitudes[p] = batch_magnitudes[k];
+                        if (states[p] == Bounded && !variant_kernel) {
+                            z_re[p] = batch_zr[k];
+                            z_im[p] = batch_zi[k];
+                        }
+                    }
+                    tile_stats.computed += batch.size();
+                }
+            }
+        }
+
+        // -----------------
+        // distance from the grid coordinate to the next multiple of step
+        static int gridPhase(const long long coordinate, const int step)
+        {
+            return static_cast <int>(((step - coordinate % step) % step + step) % step);
+        }
+
+        // -----------------
+        // counts, magnitudes and colors of the tile. A pixel that was
+        // not sampled yet takes the value of the closest known sample
+        // of a coarser pass, an undecided one counts as inside the set.
+        void composeTile(Frame &frame, const int x0, const int y0, const int x1, const int y1) const
+        {
+            const int cap = grid.iterations;
+
+            for (int row = y0; row < y1; ++row) {
+                for (int x = x0; x < x1; ++x) {
+                    std::size_t p = static_cast <std::size_t>(row) * grid.width + x;
+                    const std::size_t target = p;
+
+                    for (int step = 2; states[p] == Unknown && step <= COARSE_STEP; step *= 2) {
+                        const int sx = x - (step - gridPhase(x + grid_x, step)) % step,
+                                  sy = row - (step - gridPhase(row - grid_y, step)) % step;
+                        if (sx >= 0 && sy >= 0) {
+                            p = static_cast <std::size_t>(sy) * grid.width + sx;
+                        }
+                    }
+
+                    const int i = states[p] == Escaped ? std::min(counts[p], cap) : cap;
+                    const float magnitude = i < cap ? magnitudes[p] : 0.0f,
+                                fraction = variant.smooth ?
+                        smoothFraction(magnitude, variant.escapeRadius(), variant.power) : 0.0f;
+                    frame.iterations[target] = i;
+                    frame.magnitudes[target] = magnitude;
+                    genColor((i + fraction) / cap, &frame.rgba[target * 4]);
+                }
+            }
+        }
+
+        // -----------------
+        // the loop of the kernels, started at iteration from with z;
+        // returns the escape time with z the first point past the
+        // radius, or iterations with z moved on
+        template <class Real>
+        int resume(const Real cr, const Real ci, Real &zr, Real &zi, const int from,
+                   const int iterations, KernelStats &kernel_stats) const
+        {
+            const bool checks = options.interior_checks;
+            if (checks && inCardioidOrBulb(cr, ci)) {
+                kernel_stats.cardioid_saved += iterations - from;
+                return iterations;
+            }
+
+            const Real tolerance = periodTolerance <Real>(),
+                       radius2 = variant.smooth ? bailout <Real, true>() : bailout <Real, false>();
+            Real x = zr,
+                 y = zi,
+                 saved_r = x,
+                 saved_i = y;
+            long long next_save = 1;
+            int i;
+
+            for (i = from; i < iterations; ++i) {
+                const Real next_x = (x * x - y * y) + cr;
+                const Real next_y = (y * x + x * y) + ci;
+
+                if (next_x * next_x + next_y * next_y > radius2) {
+                    kernel_stats.iterations += i + 1 - from;
+                    zr = next_x;
+                    zi = next_y;
+                    return i;
+                }
+
+                x = next_x;
+                y = next_y;
+
+                if (checks) {
+                    const Real dr = x - saved_r,
+                               di = y - saved_i;
+                    if (dr * dr + di * di < tolerance) {
+                        kernel_stats.iterations += i + 1 - from;
+                        kernel_stats.periodicity_saved += iterations - (i + 1);
+                        break;
+                    }
+                    if (i + 1 - from == next_save) {
+                        saved_r = x;
+                        saved_i = y;
+                        next_save *= 2;
+                    }
+                }
+            }
+
+            if (i == iterations) {
+                kernel_stats.iterations += iterations - from;
+            }
+            zr = x;
+            zi = y;
+            return iterations;
+        }
+
+        // -----------------
+        // follows a move of the center by (dx, dy) pixels: pixel
+        // (x, row) takes the value of the old pixel (x + dx, row - dy),
+        // pixels with no such neighbour get fill
+        template <class T>
+        void shift(std::vector <T> &data, const int dx, const int dy, const T &fill) const
+        {
+            const int w = grid.width,
+                      h = grid.height;
+            const int x0 = std::max(0, -dx),
+                      x1 = std::min(w, w - dx);
+            std::vector <T> moved(data.size(), fill);
+
+            for (int row = std::max(0, dy); row < std::min(h, h + dy); ++row) {
+                const T *source = &data[static_cast <std::size_t>(row - dy) * w + x0 + dx];
+                std::copy(source, source + (x1 - x0),
+                          &moved[static_cast <std::size_t>(row) * w + x0]);
+            }
+            data.swap(moved);
+        }
+    };
+};
+
+#endif  //INCREMENTAL_RENDERER_HPP
@@ -5,7 +5,14 @@
 #include <GL/glfw3.h>
 
 #include <cstdlib>
+#include <string>
 
+#include "antialias.hpp"
+#include "colorizer.hpp"
+#include "cpu_renderer.hpp"
+#include "fractal_variant.hpp"
+#include "frame_stats.hpp"
+#include "incremental_renderer.hpp"
 #include "shader.hpp"
 
 namespace GL
@@ -16,21 +23,74 @@ namespace GL
     
     // ------------------
     // uniforms required for user interaction with
-    // rendering process
-    float zoom = 1,
-          cx = -0.5,
-          cy = 0;
+    // rendering process. They are kept in more precision
+    // than the shader uses: once the zoom is too deep for
+    // float, frames are rendered on the CPU instead
+    double zoom = 1;
+    QuadDouble cx = -0.5,
+               cy = 0;
     
     // ------------------
     // number of Mandelbrot iterations.
     // default value is 100, but user can change it
     int iterations = 100;
     
+    // ------------------
+    // milliseconds a frame may spend on the CPU renderer. What
+    // does not fit is refined during the next frames
+    double frame_budget = 25;
+    
+    // ------------------
+    // the View uniform block of mandelbrot.fs, std140 layout
+    struct ViewBlock
+    {
+        float screen_size[2];
+        float center[2];
+        float screen_ratio;
+        float zoom;
+        int iterations;
+        int padding;
+    };
+    static_assert(sizeof(ViewBlock) == 32, "ViewBlock must match the std140 layout of View");
+    
+    // -----------------
+    // F5 switches the formula, F6 the exponent, F7 smooth coloring,
+    // F8 compiles the iteration count into the shader
+    FractalVariant variant;
+    bool fixed_iterations = false,
+         variant_changed = false;
+    
+    // -----------------
+    // F9 cycles the palettes, F10 equalizes the colors of the frames
+    // drawn on the CPU (the shader colors a pixel without seeing the
+    // others)
+    CPU::ColorOptions color_options;
+    
+    // -----------------
+    // F11 anti-aliases the edges: the shader samples them again in the
+    // same pass, the CPU once a frame is complete and the view still
+    bool antialias = false;
+    CPU::AntiAliasOptions antialias_options;
+    
+    // -----------------
+    // F3 shows frame timings in the window title, F12 saves the
+    // last frames as a Chrome trace
+    bool show_stats = false,
+         save_trace = false;
+    const char *trace_path = "frame_trace.json";
+    
     // -----------------
     // IO callbacks
     void framebufferSizeCallback(GLFWwindow * const window, const int width, const int height);
     void scrollCallback(GLFWwindow * const window, const double xoffset, const double yoffset);
+    void keyCallback(GLFWwindow * const window, const int key, const int scancode,
+                     const int action, const int mods);
     void processInput(GLFWwindow *window);
+    
+    // -----------------
+    // copies a frame rendered on the CPU into the texture
+    // that texture.fs draws
+    void uploadFrame(const unsigned texture, const CPU::Frame &frame);
 };
 
 int main()
@@ -65,6 +125,7 @@ int main()
     glfwMakeContextCurrent(window);
     glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
     glfwSetScrollCallback(window, scrollCallback);
+    glfwSetKeyCallback(window, keyCallback);
 
     // ------------------------------
     // glad: load all OpenGL function pointers
@@ -73,7 +134,53 @@ int main()
         return 0;
     }
     
-    Shader mandelbrot_shader("mandelbrot.vs", "mandelbrot.fs");
+    // ---------------
+    // linked programs are kept across runs, and the files of the
+    // shaders are read while the rest is set up
+    ProgramCache program_cache("shader_cache",
+                               reinterpret_cast <ProgramCache::LoadProc>(glfwGetProcAddress));
+    auto texture_source = ShaderSource::loadAsync("texture.vs", "texture.fs", "", {},
+                                                  &program_cache);
+    
+    // ---------------
+    // view parameters of the shader, uploaded in one call per frame
+    UniformBuffer <ViewBlock> view_buffer(0);
+    ViewBlock view_block = {};
+    
+    // ---------------
+    // one program per variant, compiled when first shown
+    ShaderVariants mandelbrot_variants("mandelbrot.vs", "mandelbrot.fs",
+                                       [&](Shader &shader) {
+        shader.bindBlock("View", view_buffer);
+    }, &program_cache);
+    Shader *mandelbrot_shader = nullptr;
+    FractalVariant shader_variant;
+    int shader_iterations = 0;
+    CPU::Palette shader_palette = CPU::Palette::Classic;
+    bool shader_antialias = false;
+    
+    // ---------------
+    // shader_iterations is 0 unless the count is compiled in
+    const auto variantKey = [&](std::vector <std::string> &defines) {
+        defines = variant.defines();
+        std::string key = variant.key();
+        if (fixed_iterations) {
+            defines.push_back("FIXED_ITERATIONS " + std::to_string(iterations));
+            key += " fixed " + std::to_string(iterations);
+        }
+        if (color_options.palette != CPU::Palette::Classic) {
+            defines.push_back("PALETTE " + std::to_string(static_cast <int>(color_options.palette)));
+            key += std::string(" ") + CPU::paletteName(color_options.palette);
+        }
+        if (antialias) {
+            defines.push_back("SAMPLES " + std::to_string(antialias_options.max_samples));
+            key += " aa";
+        }
+        return key;
+    };
+    std::vector <std::string> defines;
+    std::string key = variantKey(defines);
+    mandelbrot_variants.prefetch(key, defines);
     
     const float square[] = {
          1,  1, 0,
@@ -94,7 +201,44 @@ int main()
                           reinterpret_cast <void *>(0));
     glEnableVertexAttribArray(0);
     
-    mandelbrot_shader.use();
+    // ---------------
+    // texture for the frames rendered on the CPU
+    unsigned frame_texture;
+    glGenTextures(1, &frame_texture);
+    glBindTexture(GL_TEXTURE_2D, frame_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    
+    std::unique_ptr <Shader> texture_shader;
+    try {
+        texture_shader.reset(new Shader(texture_source.get(), &program_cache));
+    }
+    catch (std::exception &e) {
+        std::cout << e.what();
+        return 0;
+    }
+    texture_shader->use();
+    texture_shader->setInt("frame", 0);
+    
+    // ---------------
+    // frames keep most of their pixels from one to the next while
+    // the view is moved around, the incremental renderer only
+    // iterates the ones that changed, coarse samples first
+    ThreadPool cpu_pool(std::thread::hardware_concurrency());
+    CPU::IncrementalRenderer cpu_renderer(cpu_pool);
+    CPU::Frame cpu_frame;
+    CPU::AntiAliaser cpu_antialiaser(cpu_pool, CPU::RenderOptions(), antialias_options);
+    std::vector <std::uint8_t> antialiased_rgba;
+    bool antialiased = false;
+    auto precision = CPU::Precision::Float;
+    
+    FrameStats frame_stats;
+    double title_time = 0,
+           reload_time = 0;
+    // the title still shows timings F3 has just hidden
+    bool stats_shown = false;
     
     glClearColor(0.2f, 0.2f, 0.2f, 1.f);
     
@@ -106,6 +250,9 @@ int main()
     int w, h;
     
     while(!glfwWindowShouldClose(window)) {
+        frame_stats.beginFrame();
+        frame_stats.phase(FrameStats::Input);
+        
         auto time = glfwGetTime();
         delta_time = time - last_time;
         last_time = time;
@@ -116,21 +263,153 @@ int main()
         
         glfwGetWindowSize(window, &w, &h);
         
-        mandelbrot_shader.setVec2("screen_size", static_cast <float>(w),
-                                                 static_cast <float>(h));
-        mandelbrot_shader.setFloat("screen_ratio", static_cast <float>(w) /
-                                                   static_cast <float>(h));
-        mandelbrot_shader.setVec2("center", cx, cy);
-        mandelbrot_shader.setFloat("zoom", zoom);
-        mandelbrot_shader.setInt("iterations", iterations);
+        // ---------------
+        // the shader is used for as long as float resolves the
+        // zoom, deeper views go through the CPU renderer in the
+        // cheapest precision that does
+        const auto needed = CPU::selectPrecision(zoom, h);
+        const bool options_changed = variant_changed;
+        const bool new_title = needed != precision || variant_changed ||
+                               (show_stats && time - title_time > 0.5) ||
+                               (stats_shown && !show_stats);
+        precision = needed;
+        if (new_title) {
+            std::string title = std::string("Mandelbrot - ") + CPU::precisionName(precision);
+            if (!variant.isDefault()) {
+                title += " - " + variant.key();
+            }
+            if (color_options.palette != CPU::Palette::Classic || color_options.equalize) {
+                title += std::string(" - ") + CPU::paletteName(color_options.palette) +
+                         (color_options.equalize ? " equalized" : "");
+            }
+            if (antialias) {
+                title += " - aa";
+            }
+            if (show_stats) {
+                title += " | " + frame_stats.summary();
+            }
+            glfwSetWindowTitle(window, title.c_str());
+            title_time = time;
+            stats_shown = show_stats;
+            variant_changed = false;
+        }
+        
+        // ---------------
+        // shaders edited on disk are swapped in while running
+        if (time - reload_time > 0.5) {
+            reload_time = time;
+            if (texture_shader->reload()) {
+                texture_shader->use();
+                texture_shader->setInt("frame", 0);
+            }
+            if (mandelbrot_variants.reload()) {
+                mandelbrot_shader = nullptr;
+            }
+        }
+        
+        if (precision == CPU::Precision::Float) {
+            const int compiled_iterations = fixed_iterations ? iterations : 0;
+            if (!mandelbrot_shader || variant != shader_variant ||
+                compiled_iterations != shader_iterations ||
+                color_options.palette != shader_palette || antialias != shader_antialias) {
+                key = variantKey(defines);
+                try {
+                    mandelbrot_shader = &mandelbrot_variants.get(key, defines);
+                }
+                catch (std::exception &e) {
+                    std::cout << e.what();
+                    break;
+                }
+                shader_iterations = compiled_iterations;
+                shader_variant = variant;
+                shader_palette = color_options.palette;
+                shader_antialias = antialias;
+            }
+            
+            frame_stats.phase(FrameStats::Uniforms);
+            view_block.screen_size[0] = static_cast <float>(w);
+            view_block.screen_size[1] = static_cast <float>(h);
+            view_block.center[0] = static_cast <float>(cx.toDouble());
+            view_block.center[1] = static_cast <float>(cy.toDouble());
+            view_block.screen_ratio = static_cast <float>(w) / static_cast <float>(h);
+            view_block.zoom = static_cast <float>(zoom);
+            view_block.iterations = iterations;
+            
+            mandelbrot_shader->use();
+            view_buffer.upload(view_block);
+        }
+        else {
+            CPU::View view;
+            view.cx = cx;
+            view.cy = cy;
+            view.zoom = zoom;
+            view.iterations = iterations;
+            view.width = w;
+            view.height = h;
+            
+            frame_stats.phase(FrameStats::Render);
+            cpu_renderer.renderOptions().precision = precision;
+            cpu_renderer.renderOptions().variant = variant;
+            const bool complete = cpu_renderer.refine(view, cpu_frame, frame_budget);
+            frame_stats.cpuWork(cpu_renderer.lastStats(), cpu_pool.size());
+            
+            // ---------------
+            // the renderer colors with gen_color, other colors are a
+            // pass over its counts
+            CPU::ColorOptions options = color_options;
+            options.smooth = variant.smooth;
+            CPU::ColorMap color_map(iterations, variant, options);
+            if (color_options.palette != CPU::Palette::Classic || color_options.equalize) {
+                CPU::colorize(cpu_pool, cpu_frame, color_map);
+            }
+            
+            // ---------------
+            // edges are sampled again once, when a complete frame is
+            // the same as the last one; the next frames reuse the
+            // result until the view or the options change
+            const CPU::IncrementalStats &refined = cpu_renderer.lastStats();
+            if (!antialias || !complete || refined.computed || refined.resumed || options_changed) {
+                antialiased = false;
+            }
+            else if (!antialiased) {
+                cpu_antialiaser.renderOptions().precision = precision;
+                cpu_antialiaser.renderOptions().variant = variant;
+                cpu_antialiaser.apply(cpu_renderer.lastView(), cpu_frame, color_map);
+                antialiased_rgba = cpu_frame.rgba;
+                antialiased = true;
+            }
+            else {
+                cpu_frame.rgba = antialiased_rgba;
+            }
+            
+            frame_stats.phase(FrameStats::Upload);
+            uploadFrame(frame_texture, cpu_frame);
+            texture_shader->use();
+        }
 
+        frame_stats.phase(FrameStats::Draw);
         glDrawArrays(GL_TRIANGLES, 0, 6);
+        frame_stats.phase(FrameStats::Swap);
         glfwSwapBuffers(window);
+        frame_stats.phase(FrameStats::Input);
         glfwPollEvents();
+        frame_stats.endFrame();
+        
+        if (save_trace) {
+            save_trace = false;
+            try {
+                frame_stats.writeTrace(trace_path);
+                std::cout << frame_stats.size() << " frames saved to " << trace_path << '\n';
+            }
+            catch (std::exception &e) {
+                std::cout << e.what();
+            }
+        }
     }
     
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
+    glDeleteTextures(1, &frame_texture);
 
     return 0;
 }
@@ -141,6 +420,13 @@ void GL::framebufferSizeCallback(GLFWwindow * const window, const int width,
     glViewport(0, 0, width, height);
 }
 
+void GL::uploadFrame(const unsigned texture, const CPU::Frame &frame)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, frame.width, frame.height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, frame.rgba.data());
+}
+
 void GL::scrollCallback(GLFWwindow * const window, const double xoffset,
                         const double yoffset)
 {
@@ -150,6 +436,51 @@ void GL::scrollCallback(GLFWwindow * const window, const double xoffset,
 	}
 }
 
+void GL::keyCallback(GLFWwindow * const window, const int key, const int scancode,
+                     const int action, const int mods)
+{
+    if (action != GLFW_PRESS) {
+        return;
+    }
+    
+    if (key == GLFW_KEY_F3) {
+        show_stats = !show_stats;
+    }
+    else if (key == GLFW_KEY_F12) {
+        save_trace = true;
+    }
+    else if (key == GLFW_KEY_F5) {
+        variant.formula = static_cast <Formula>((static_cast <int>(variant.formula) + 1) % 3);
+        variant_changed = true;
+    }
+    else if (key == GLFW_KEY_F6) {
+        variant.power = variant.power < FractalVariant::MAX_POWER ? variant.power + 1 :
+                                                                   FractalVariant::MIN_POWER;
+        variant_changed = true;
+    }
+    else if (key == GLFW_KEY_F7) {
+        variant.smooth = !variant.smooth;
+        variant_changed = true;
+    }
+    else if (key == GLFW_KEY_F8) {
+        fixed_iterations = !fixed_iterations;
+        variant_changed = true;
+    }
+    else if (key == GLFW_KEY_F9) {
+        color_options.palette = static_cast <CPU::Palette>(
+            (static_cast <int>(color_options.palette) + 1) % CPU::PALETTES);
+        variant_changed = true;
+    }
+    else if (key == GLFW_KEY_F10) {
+        color_options.equalize = !color_options.equalize;
+        variant_changed = true;
+    }
+    else if (key == GLFW_KEY_F11) {
+        antialias = !antialias;
+        variant_changed = true;
+    }
+}
+
 void GL::processInput(GLFWwindow *window)
 {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
@@ -0,0 +1,362 @@
+/* Double-double and quad-double numbers: unevaluated sums of two or
+   four doubles, giving about 106 and 212 bits of mantissa. They fill
+   the zoom band between double precision and the FixedPoint reference
+   of the perturbation renderer at a fraction of the cost of bignums.
+   The algorithms are the "sloppy" ones of Hida, Li and Bailey's QD
+   library, which is all escape-time iteration needs.*/
+
+#ifndef MULTI_DOUBLE_HPP
+#define MULTI_DOUBLE_HPP
+
+#include <cmath>
+#include <limits>
+#include <string>
+
+#include "fixed_point.hpp"
+
+namespace MultiDouble
+{
+    // ------------------
+    // s = a + b exactly as s + err
+    inline double twoSum(const double a, const double b, double &err)
+    {
+        const double s = a + b,
+                     bb = s - a;
+        err = (a - (s - bb)) + (b - bb);
+        return s;
+    }
+
+    // ------------------
+    // same, when |a| >= |b| is known
+    inline double quickTwoSum(const double a, const double b, double &err)
+    {
+        const double s = a + b;
+        err = b - (s - a);
+        return s;
+    }
+
+    // ------------------
+    // p = a * b exactly as p + err. Dekker's splitting is used instead of
+    // std::fma, which is a slow library call on CPUs without FMA units.
+    inline double twoProd(const double a, const double b, double &err)
+    {
+#ifdef __FMA__
+        const double p = a * b;
+        err = std::fma(a, b, -p);
+        return p;
+#else
+        const auto split = [](const double v, double &hi, double &lo) {
+            const double t = 134217729.0 * v;  // 2^27 + 1
+            hi = t - (t - v);
+            lo = v - hi;
+        };
+
+        double a_hi, a_lo, b_hi, b_lo;
+        split(a, a_hi, a_lo);
+        split(b, b_hi, b_lo);
+
+        const double p = a * b;
+        err = ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+        return p;
+#endif
+    }
+
+    inline void threeSum(double &a, double &b, double &c)
+    {
+        double t2, t3;
+        const double t1 = twoSum(a, b, t2);
+        a = twoSum(c, t1, t3);
+        b = twoSum(t2, t3, c);
+    }
+
+    inline void threeSum2(double &a, double &b, const double c)
+    {
+        double t2, t3;
+        const double t1 = twoSum(a, b, t2);
+        a = twoSum(c, t1, t3);
+        b = t2 + t3;
+    }
+};
+
+class DoubleDouble
+{
+public:
+    double hi = 0,
+           lo = 0;
+
+    DoubleDouble() = default;
+    DoubleDouble(const double value) : hi(value) {}
+    DoubleDouble(const double h, const double l) : hi(h), lo(l) {}
+
+    double toDouble() const
+    {
+        return hi + lo;
+    }
+
+    DoubleDouble operator-() const
+    {
+        return DoubleDouble(-hi, -lo);
+    }
+
+    friend DoubleDouble operator+(const DoubleDouble &a, const DoubleDouble &b)
+    {
+        double err;
+        const double s = MultiDouble::twoSum(a.hi, b.hi, err);
+        err += a.lo + b.lo;
+
+        DoubleDouble result;
+        result.hi = MultiDouble::quickTwoSum(s, err, result.lo);
+        return result;
+    }
+
+    friend DoubleDouble operator-(const DoubleDouble &a, const DoubleDouble &b)
+    {
+        return a + -b;
+    }
+
+    friend DoubleDouble operator*(const DoubleDouble &a, const DoubleDouble &b)
+    {
+        double err;
+        const double p = MultiDouble::twoProd(a.hi, b.hi, err);
+        err += a.hi * b.lo + a.lo * b.hi;
+
+        DoubleDouble result;
+        result.hi = MultiDouble::quickTwoSum(p, err, result.lo);
+        return result;
+    }
+
+    DoubleDouble &operator+=(const DoubleDouble &other)
+    {
+        return *this = *this + other;
+    }
+    DoubleDouble &operator-=(const DoubleDouble &other)
+    {
+        return *this = *this - other;
+    }
+    DoubleDouble &operator*=(const DoubleDouble &other)
+    {
+        return *this = *this * other;
+    }
+
+    friend bool operator<(const DoubleDouble &a, const DoubleDouble &b)
+    {
+        return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+    }
+    friend bool operator>(const DoubleDouble &a, const DoubleDouble &b)
+    {
+        return b < a;
+    }
+};
+
+class QuadDouble
+{
+public:
+    double x[4] = {0, 0, 0, 0};
+
+    QuadDouble() = default;
+    QuadDouble(const double value)
+    {
+        x[0] = value;
+    }
+    QuadDouble(const double x0, const double x1, const double x2, const double x3)
+    {
+        x[0] = x0;
+        x[1] = x1;
+        x[2] = x2;
+        x[3] = x3;
+    }
+
+    // ------------------
+    // decimal literal with up to ~64 significant digits
+    static QuadDouble fromString(const std::string &text)
+    {
+        return FixedPoint <9>::fromString(text).to <QuadDouble>();
+    }
+
+    double toDouble() const
+    {
+        return x[0] + x[1] + x[2] + x[3];
+    }
+
+    DoubleDouble toDoubleDouble() const
+    {
+        DoubleDouble result;
+        result.hi = MultiDouble::quickTwoSum(x[0], x[1] + x[2] + x[3], result.lo);
+        return result;
+    }
+
+    QuadDouble operator-() const
+    {
+        return QuadDouble(-x[0], -x[1], -x[2], -x[3]);
+    }
+
+    friend QuadDouble operator+(const QuadDouble &a, const QuadDouble &b)
+    {
+        using namespace MultiDouble;
+        double t0, t1, t2, t3;
+
+        double s0 = twoSum(a.x[0], b.x[0], t0),
+               s1 = twoSum(a.x[1], b.x[1], t1),
+               s2 = twoSum(a.x[2], b.x[2], t2),
+               s3 = twoSum(a.x[3], b.x[3], t3);
+
+        s1 = twoSum(s1, t0, t0);
+        threeSum(s2, t0, t1);
+        threeSum2(s3, t0, t2);
+        t0 = t0 + t1 + t3;
+
+        return renormalized(s0, s1, s2, s3, t0);
+    }
+
+    friend QuadDouble operator-(const QuadDouble &a, const QuadDouble &b)
+    {
+        return a + -b;
+    }
+
+    friend QuadDouble operator*(const QuadDouble &a, const QuadDouble &b)
+    {
+        using namespace MultiDouble;
+        double q0, q1, q2, q3, q4, q5, t0, t1;
+
+        double p0 = twoProd(a.x[0], b.x[0], q0),
+               p1 = twoProd(a.x[0], b.x[1], q1),
+               p2 = twoProd(a.x[1], b.x[0], q2),
+               p3 = twoProd(a.x[0], b.x[2], q3),
+               p4 = twoProd(a.x[1], b.x[1], q4),
+               p5 = twoProd(a.x[2], b.x[0], q5);
+
+        threeSum(p1, p2, q0);
+
+        // -------------------
+        // (s0, s1, s2) = (p2, q1, q2) + (p3, p4, p5)
+        threeSum(p2, q1, q2);
+        threeSum(p3, p4, p5);
+
+        const double s0 = twoSum(p2, p3, t0);
+        double s1 = twoSum(q1, p4, t1),
+               s2 = q2 + p5;
+        s1 = twoSum(s1, t0, t0);
+        s2 += t0 + t1;
+
+        // -------------------
+        // O(eps^3) terms
+        s1 += a.x[0] * b.x[3] + a.x[1] * b.x[2] + a.x[2] * b.x[1] +
+              a.x[3] * b.x[0] + q0 + q3 + q4 + q5;
+
+        return renormalized(p0, p1, s0, s1, s2);
+    }
+
+    QuadDouble &operator+=(const QuadDouble &other)
+    {
+        return *this = *this + other;
+    }
+    QuadDouble &operator-=(const QuadDouble &other)
+    {
+        return *this = *this - other;
+    }
+    QuadDouble &operator*=(const QuadDouble &other)
+    {
+        return *this = *this * other;
+    }
+
+    friend bool operator<(const QuadDouble &a, const QuadDouble &b)
+    {
+        for (int k = 0; k < 4; ++k) {
+            if (a.x[k] != b.x[k])
+                return a.x[k] < b.x[k];
+        }
+        return false;
+    }
+    friend bool operator>(const QuadDouble &a, const QuadDouble &b)
+    {
+        return b < a;
+    }
+
+private:
+    static QuadDouble renormalized(double c0, double c1, double c2, double c3,
+                                   double c4)
+    {
+        using MultiDouble::quickTwoSum;
+
+        if (std::isinf(c0)) {
+            return QuadDouble(c0, c1, c2, c3);
+        }
+
+        double s0 = quickTwoSum(c3, c4, c4);
+        s0 = quickTwoSum(c2, s0, c3);
+        s0 = quickTwoSum(c1, s0, c2);
+        c0 = quickTwoSum(c0, s0, c1);
+
+        s0 = c0;
+        double s1 = c1,
+               s2 = 0,
+               s3 = 0;
+
+        if (s1 != 0) {
+            s1 = quickTwoSum(s1, c2, s2);
+            if (s2 != 0) {
+                s2 = quickTwoSum(s2, c3, s3);
+                if (s3 != 0)
+                    s3 += c4;
+                else
+                    s2 = quickTwoSum(s2, c4, s3);
+            }
+            else {
+                s1 = quickTwoSum(s1, c3, s2);
+                if (s2 != 0)
+                    s2 = quickTwoSum(s2, c4, s3);
+                else
+                    s1 = quickTwoSum(s1, c4, s2);
+            }
+        }
+        else {
+            s0 = quickTwoSum(s0, c2, s1);
+            if (s1 != 0) {
+                s1 = quickTwoSum(s1, c3, s2);
+                if (s2 != 0)
+                    s2 = quickTwoSum(s2, c4, s3);
+                else
+                    s1 = quickTwoSum(s1, c4, s2);
+            }
+            else {
+                s0 = quickTwoSum(s0, c3, s1);
+                if (s1 != 0)
+                    s1 = quickTwoSum(s1, c4, s2);
+                else
+                    s0 = quickTwoSum(s0, c4, s1);
+            }
+        }
+        return QuadDouble(s0, s1, s2, s3);
+    }
+};
+
+// ------------------
+// only what generic numeric code asks for
+namespace std
+{
+    template <>
+    struct numeric_limits <DoubleDouble>
+    {
+        static constexpr bool is_specialized = true;
+        static constexpr int digits = 106;
+
+        static DoubleDouble epsilon()
+        {
+            return 4.93038065763132e-32;  // 2^-104
+        }
+    };
+
+    template <>
+    struct numeric_limits <QuadDouble>
+    {
+        static constexpr bool is_specialized = true;
+        static constexpr int digits = 212;
+
+        static QuadDouble epsilon()
+        {
+            return 1.21543267145725e-63;  // 2^-209
+        }
+    };
+};
+
+#endif  //MULTI_DOUBLE_HPP
@@ -0,0 +1,297 @@
+/* Deep zoom renderer based on perturbation theory.
+   One reference orbit Z_n is computed at the view center with
+   FixedPoint arithmetic, then every pixel iterates only its difference
+   d_n = z_n - Z_n from that orbit in plain double precision:
+
+       d_(n+1) = 2 Z_n d_n + d_n^2 + dc
+
+   A third order series d_n ~ A_n dc + B_n dc^2 + C_n dc^3, shared by the
+   whole frame, lets every pixel skip the first iterations. Glitches
+   (the pixel orbit drifting away from a reference that can no longer
+   describe it) are avoided by rebasing: whenever |z_n| < |d_n|, or the
+   reference runs out, the pixel restarts from the beginning of the
+   reference with d = z_n.
+
+   Deltas are doubles, which keeps zooms up to about 1e150 working; the
+   center only has to be given with enough decimal digits.*/
+
+#ifndef PERTURBATION_HPP
+#define PERTURBATION_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cpu_renderer.hpp"
+#include "fixed_point.hpp"
+#include "thread_pool.hpp"
+
+namespace CPU
+{
+    // ------------------
+    // a View whose center is kept as decimal text, so it can carry more
+    // digits than a double
+    struct DeepView
+    {
+        std::string cx = "-0.5",
+                    cy = "0";
+        double zoom = 1;
+        int iterations = 100;
+        int width = 1000,
+            height = 800;
+
+        // ---------------
+        // View with the same size and zoom, for its pixel offsets
+        View offsets() const
+        {
+            View view;
+            view.zoom = zoom;
+            view.iterations = iterations;
+            view.width = width;
+            view.height = height;
+            return view;
+        }
+    };
+
+    struct PerturbationStats
+    {
+        int reference_length = 0;
+        int skipped_iterations = 0;
+        std::size_t rebases = 0;
+    };
+
+    class PerturbationRenderer
+    {
+    public:
+        explicit PerturbationRenderer(ThreadPool &thread_pool, const int tile = 64)
+            : pool(thread_pool), tile_size(std::max(tile, 1))
+        {}
+
+        void render(const DeepView &view, Frame &frame)
+        {
+            // ----------------
+            // the reference needs about as many bits as the pixel spacing
+            // is small, plus a margin for the rounding of ~iterations steps
+            const double bits = std::log2(std::max(view.zoom, 1.0)) +
+                                std::log2(std::max(view.width, view.height)) + 64;
+
+            if (bits <= FixedPoint <4>::precision)
+                referenceOrbit <4>(view);
+            else if (bits <= FixedPoint <8>::precision)
+                referenceOrbit <8>(view);
+            else if (bits <= FixedPoint <16>::precision)
+                referenceOrbit <16>(view);
+            else if (bits <= FixedPoint <32>::precision)
+                referenceOrbit <32>(view);
+            else
+                throw std::range_error("PerturbationRenderer: zoom is too deep\n");
+
+            const View offsets = view.offsets();
+            radius = std::max(std::abs(std::complex <double>(offsets.offsetRe(0), offsets.offsetIm(0))),
+                              std::abs(std::complex <double>(offsets.offsetRe(view.width - 1),
+                                                             offsets.offsetIm(view.height - 1))));
+            radius = std::max(radius, std::numeric_limits <double>::min());
+            seriesCoefficients(view.iterations);
+            skip = validSkip(offsets);
+
+            stats = PerturbationStats();
+            stats.reference_length = static_cast <int>(orbit.size());
+            stats.skipped_iterations = skip;
+            std::atomic <std::size_t> rebases {0};
+
+            frame.resize(view.width, view.height);
+
+            const int tiles_x = (view.width + tile_size - 1) / tile_size,
+                      tiles_y = (view.height + tile_size - 1) / tile_size;
+
+            pool.run(static_cast <std::size_t>(tiles_x) * tiles_y,
+                     [&](const std::size_t index, unsigned) {
+                const int x0 = static_cast <int>(index % tiles_x) * tile_size,
+                          y0 = static_cast <int>(index / tiles_x) * tile_size,
+                          x1 = std::min(x0 + tile_size, view.width),
+                          y1 = std::min(y0 + tile_size, view.height);
+                std::size_t tile_rebases = 0;
+
+                for (int row = y0; row < y1; ++row) {
+                    for (int x = x0; x < x1; ++x) {
+                        const std::size_t p = static_cast <std::size_t>(row) * view.width + x;
+                        const int i = iterate({offsets.offsetRe(x), offsets.offsetIm(row)},
+                                              view.iterations, frame.magnitudes[p], tile_rebases);
+
+                        frame.iterations[p] = i;
+                        genColor(static_cast <float>(i) / view.iterations,
+                                 &frame.rgba[p * 4]);
+                    }
+                }
+                rebases += tile_rebases;
+            });
+
+            stats.rebases = rebases;
+        }
+
+        const PerturbationStats &lastStats() const
+        {
+            return stats;
+        }
+
+    private:
+        using Complex = std::complex <double>;
+
+        // ------------------
+        // series coefficients scaled by the frame radius r, so that
+        // d_n = a u + b u^2 + c u^3 with u = dc / r stays in range
+        // however deep the zoom is
+        struct Series
+        {
+            Complex a, b, c;
+        };
+
+        ThreadPool &pool;
+        int tile_size;
+
+        std::vector <Complex> orbit;
+        std::vector <Series> series;
+        double radius = 0;
+        int skip = 0;
+        PerturbationStats stats;
+
+        // ------------------
+        // Z_0 = 0 up to the last iteration or the first Z with |Z| > 2
+        template <int Limbs>
+        void referenceOrbit(const DeepView &view)
+        {
+            using Fixed = FixedPoint <Limbs>;
+
+            const Fixed cr = Fixed::fromString(view.cx),
+                        ci = Fixed::fromString(view.cy);
+            Fixed zr, zi;
+
+            orbit.assign(1, Complex(0, 0));
+            for (int n = 0; n < view.iterations; ++n) {
+                const Fixed zri = zr * zi;
+                zr = zr * zr - zi * zi + cr;
+                zi = zri + zri + ci;
+
+                const Complex z(zr.toDouble(), zi.toDouble());
+                orbit.push_back(z);
+                if (std::norm(z) > 4)
+                    break;
+            }
+        }
+
+        // ------------------
+        // stops growing once the cubic term is no longer negligible
+        void seriesCoefficients(const int iterations)
+        {
+            const int last = std::min(iterations, static_cast <int>(orbit.size()) - 1);
+            Series s {0, 0, 0};
+
+            series.assign(1, s);
+            for (int n = 0; n < last; ++n) {
+                const Complex twice_z = 2.0 * orbit[n];
+                const Series next {twice_z * s.a + radius,
+                                   twice_z * s.b + s.a * s.a,
+                                   twice_z * s.c + 2.0 * s.a * s.b};
+
+                if (!std::isfinite(std::abs(next.c)) ||
+                    std::abs(next.c) > 1e-12 * std::abs(next.a)) {
+                    break;
+                }
+                s = next;
+                series.push_back(s);
+            }
+        }
+
+        Complex seriesAt(const int n, const Complex &dc) const
+        {
+            const Complex u = dc / radius;
+            const Series &s = series[n];
+            return ((s.c * u + s.b) * u + s.a) * u;
+        }
+
+        // ------------------
+        // the truncation test above says nothing about the pixels at the
+        // border of the frame, so the corners and edge midpoints are
+        // iterated exactly and the skip is cut back to the last step where
+        // the series still agreed with all of them
+        int validSkip(const View &offsets) const
+        {
+            int limit = static_cast <int>(series.size()) - 1;
+            const double xs[] = {0, (offsets.width - 1) / 2.0, offsets.width - 1.0},
+                         ys[] = {0, (offsets.height - 1) / 2.0, offsets.height - 1.0};
+
+            for (const double x : xs) {
+                for (const double y : ys) {
+                    const Complex dc(offsets.offsetRe(x), offsets.offsetIm(y));
+                    Complex d(0, 0);
+
+                    for (int n = 0; n < limit; ++n) {
+                        d = 2.0 * orbit[n] * d + d * d + dc;
+
+                        const Complex z = orbit[n + 1] + d;
+                        const double error = std::abs(seriesAt(n + 1, dc) - d);
+                        if (std::norm(z) > 4 || std::norm(z) < std::norm(d) ||
+                            error > 1e-9 * std::abs(d)) {
+                            limit = n;
+                            break;
+                        }
+                    }
+                }
+            }
+            return std::max(limit, 0);
+        }
+
+        // ------------------
+        // escape time of the pixel at offset dc from the center, with the
+        // same counting as escapeTime(), and |z| where it escaped (0 if
+        // it did not)
+        int iterate(const Complex dc, const int iterations, float &escape_magnitude,
+                    std::size_t &rebases) const
+        {
+            escape_magnitude = 0;
+            const int last = static_cast <int>(orbit.size()) - 1;
+            int n = skip,
+                i = skip;
+            double dr, di;
+            {
+                const Complex d = seriesAt(skip, dc);
+                dr = d.real();
+                di = d.imag();
+            }
+
+            for (; i < iterations; ++i) {
+                const double zr = orbit[n].real(),
+                             zi = orbit[n].imag();
+                const double nr = 2 * (zr * dr - zi * di) + (dr * dr - di * di) + dc.real(),
+                             ni = 2 * (zr * di + zi * dr) + 2 * dr * di + dc.imag();
+                dr = nr;
+                di = ni;
+                ++n;
+
+                const double x = orbit[n].real() + dr,
+                             y = orbit[n].imag() + di,
+                             magnitude = x * x + y * y;
+                if (magnitude > 4) {
+                    escape_magnitude = static_cast <float>(std::sqrt(magnitude));
+                    break;
+                }
+
+                if (magnitude < dr * dr + di * di || n == last) {
+                    dr = x;
+                    di = y;
+                    n = 0;
+                    ++rebases;
+                }
+            }
+            return i;
+        }
+    };
+};
+
+#endif  //PERTURBATION_HPP
@@ -0,0 +1,243 @@
+/* On-disk cache of linked shader programs (ARB_get_program_binary, core
+   in OpenGL 4.1). Once a program is linked, its binary is written to
+   a file named after a hash of its sources and of the driver, and the
+   next start loads that file instead of compiling: binaries only load
+   on the driver that made them, which may still refuse one (after an
+   update, say), in which case the file is dropped and the program is
+   compiled as usual.
+
+   The glad loader of this project stops at OpenGL 3.3, so the three
+   functions involved are looked up by the cache itself. Without them,
+   or with a driver that offers no binary format, the cache does
+   nothing. Files are read from any thread (see ShaderSource) and
+   written in the background.*/
+
+#ifndef PROGRAM_CACHE_HPP
+#define PROGRAM_CACHE_HPP
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// ------------------------
+// 64 bit FNV-1a, continued from hash
+inline std::uint64_t fnv1a(const std::string &text,
+                           std::uint64_t hash = 14695981039346656037ull)
+{
+    for (const unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+class ProgramCache
+{
+public:
+    using LoadProc = void *(*)(const char *name);
+
+    // ------------------------
+    // needs a current context; load is the function glad was loaded
+    // with (glfwGetProcAddress)
+    ProgramCache(const std::string &cache_directory, const LoadProc load)
+        : directory(cache_directory)
+    {
+        get_binary = reinterpret_cast <GetProgramBinary>(load("glGetProgramBinary"));
+        program_binary = reinterpret_cast <ProgramBinary>(load("glProgramBinary"));
+        program_parameter = reinterpret_cast <ProgramParameteri>(load("glProgramParameteri"));
+
+        int formats = 0;
+        if (get_binary && program_binary && program_parameter) {
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        }
+
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        enabled = formats > 0 && !error;
+
+        for (const GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+            const GLubyte *text = glGetString(name);
+            driver += text ? reinterpret_cast <const char *>(text) : "";
+            driver += '\n';
+        }
+    }
+
+    ProgramCache(const ProgramCache &) = delete;
+    ProgramCache &operator=(const ProgramCache &) = delete;
+
+    // ------------------------
+    // lets the last writes finish
+    ~ProgramCache()
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        for (std::future <void> &write : writes) {
+            write.wait();
+        }
+    }
+
+    bool isEnabled() const
+    {
+        return enabled;
+    }
+
+    // ------------------------
+    // key of a program made of the given sources on this driver
+    std::uint64_t keyOf(const std::vector <std::string> &sources) const
+    {
+        std::uint64_t hash = fnv1a(driver);
+        for (const std::string &source : sources) {
+            hash = fnv1a(source, hash);
+            hash = fnv1a(std::string(1, '\0'), hash);
+        }
+        return hash;
+    }
+
+    // ------------------------
+    // the stored binary, or nothing; safe on any thread
+    std::vector <char> read(const std::uint64_t key) const
+    {
+        std::vector <char> binary;
+        if (!enabled) {
+            return binary;
+        }
+
+        std::ifstream in(pathOf(key), std::ios::binary);
+        if (in) {
+            binary.assign(std::istreambuf_iterator <char>(in), std::istreambuf_iterator <char>());
+        }
+        if (binary.size() <= HEADER || std::memcmp(binary.data(), MAGIC, 4) != 0) {
+            binary.clear();
+        }
+        return binary;
+    }
+
+    // ------------------------
+    // to be called on a program before it is linked, so that its
+    // binary can be retrieved
+    void prepare(const unsigned program) const
+    {
+        if (enabled) {
+            program_parameter(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+    }
+
+    // ------------------------
+    // links program from a binary read(); false if the driver did
+    // not take it, the file is then removed
+    bool load(const unsigned program, const std::uint64_t key, const std::vector <char> &binary)
+    {
+        if (!enabled || binary.size() <= HEADER) {
+            return false;
+        }
+
+        std::uint32_t format;
+        std::memcpy(&format, binary.data() + 4, sizeof(format));
+        program_binary(program, format, binary.data() + HEADER,
+                       static_cast <GLsizei>(binary.size() - HEADER));
+
+        int linked = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            std::error_code error;
+            std::filesystem::remove(pathOf(key), error);
+        }
+        return linked != 0;
+    }
+
+    // ------------------------
+    // saves a linked program; the file is written in the background
+    void store(const unsigned program, const std::uint64_t key)
+    {
+        if (!enabled) {
+            return;
+        }
+
+        int length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) {
+            return;
+        }
+
+        std::vector <char> binary(HEADER + length);
+        GLenum format = 0;
+        get_binary(program, length, &length, &format, binary.data() + HEADER);
+        binary.resize(HEADER + length);
+
+        const std::uint32_t format_bits = format;
+        std::memcpy(binary.data(), MAGIC, 4);
+        std::memcpy(binary.data() + 4, &format_bits, sizeof(format_bits));
+
+        const std::string path = pathOf(key);
+        std::lock_guard <std::mutex> lock(mutex);
+        writes.erase(std::remove_if(writes.begin(), writes.end(), [](std::future <void> &write) {
+            return write.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+        }), writes.end());
+        writes.push_back(std::async(std::launch::async, [path, binary]() {
+            // ------------------
+            // written aside and renamed, so that a reader never sees
+            // half a file
+            const std::string part = path + ".part";
+            {
+                std::ofstream out(part, std::ios::binary);
+                out.write(binary.data(), binary.size());
+                if (!out) {
+                    return;
+                }
+            }
+            std::error_code error;
+            std::filesystem::rename(part, path, error);
+        }));
+    }
+
+private:
+    using GetProgramBinary = void (APIENTRYP)(GLuint, GLsizei, GLsizei *, GLenum *, void *);
+    using ProgramBinary = void (APIENTRYP)(GLuint, GLenum, const void *, GLsizei);
+    using ProgramParameteri = void (APIENTRYP)(GLuint, GLenum, GLint);
+
+    // ------------------------
+    // a file is MAGIC, the binary format (32 bits) and the binary
+    static constexpr const char *MAGIC = "MPB1";
+    static constexpr std::size_t HEADER = 8;
+
+    std::string directory,
+                driver;
+    bool enabled = false;
+
+    GetProgramBinary get_binary = nullptr;
+    ProgramBinary program_binary = nullptr;
+    ProgramParameteri program_parameter = nullptr;
+
+    std::mutex mutex;
+    std::vector <std::future <void>> writes;
+
+    std::string pathOf(const std::uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", static_cast <unsigned long long>(key));
+        return directory + "/" + name;
+    }
+};
+
+#endif  //PROGRAM_CACHE_HPP
@@ -0,0 +1,771 @@
+/* Headless renderer for machines without a GPU or a display.
+   Renders one view, or a zoom sequence, with the CPU engine. Images
+   are rendered in bands of rows that are streamed to the output file
+   as soon as they are done, so their size is not limited by memory.
+
+   usage: mandelbrot_render [options]
+     -o <file>        output image, PNG if it ends in .png, binary PPM
+                      otherwise (default mandelbrot.ppm). With -K, a
+                      printf pattern for the frame number such as
+                      frame%05d.png
+     -w <width>       image width (default 1000)
+     -h <height>      image height (default 800)
+     -x <cx>          center, real part (default -0.5)
+     -y <cy>          center, imaginary part (default 0)
+     -z <zoom>        zoom (default 1)
+     -i <iterations>  number of iterations (default 100)
+     -t <threads>     worker threads (default: all cores)
+     -k <isa>         iteration kernel: scalar, sse2, avx2 or avx512
+                      (default: the widest one this CPU supports; one it
+                      does not support is refused)
+     -p <precision>   float (as the shader), double, dd (double-double),
+                      qd (quad-double) or auto, the cheapest one that
+                      resolves the zoom (default auto)
+     -c <on|off>      cardioid / bulb test and periodicity checking
+                      (default on)
+     -m <mode>        direct (default), subdivide (iterate only the borders
+                      of rectangles, fill uniform ones; faster, but a few
+                      pixels may differ from direct), perturbation,
+                      for deep zooms (-x and -y may then have as many
+                      digits as needed) or tiled (through a cache of
+                      tiles, the precision follows the tile level)
+     -f <formula>     mandelbrot (default), burning-ship or julia
+     -n <power>       exponent of z, 2 to 5 (default 2)
+     -j <re,im>       c of the Julia set (default -0.8,0.156)
+     -s <on|off>      smooth coloring (default off)
+                      any variant but the default one takes the direct
+                      or subdivide mode, and only z^2 + c subdivides
+     -P <palette>     classic (default), fire, cyclic or grey
+     -e <on|off>      histogram equalization of the colors (default off)
+     -d <file>        also saves the counts and |z| of every pixel, for
+                      -r; a pattern like -o with -K
+     -r <file>        recolors counts saved with -d into -o with -P, -e
+                      and -s, without iterating; the other options are
+                      ignored
+     -a <samples>     adaptive anti-aliasing: pixels on an edge take up
+                      to this many samples, the others keep one (default
+                      1, off); not with the perturbation mode
+     -N <workers>     renders through this many worker processes started
+                      on this machine, which share -t threads; the direct
+                      and subdivide modes only
+     -L <port>        also takes workers from other machines on this port
+     -W <host:port>   runs as a worker of the coordinator at host:port,
+                      with -t threads and -k; the other options come from
+                      the coordinator
+     -M <megabytes>   tile cache memory budget (default 256)
+     -S <file>        file the tile cache spills to (default none)
+     -D <megabytes>   budget of the spill file (default 1024)
+     -b <rows>        rows per band (default: about 4 megapixels worth)
+     -K <file>        keyframes of a zoom sequence, one per line:
+                          frame cx cy zoom iterations
+                      frames in between are interpolated, the zoom
+                      geometrically; -x, -y, -z and -i are ignored*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "antialias.hpp"
+#include "colorizer.hpp"
+#include "cpu_renderer.hpp"
+#include "distributed_renderer.hpp"
+#include "image_writer.hpp"
+#include "perturbation.hpp"
+#include "tile_cache.hpp"
+#include "tiled_renderer.hpp"
+
+namespace
+{
+    struct Keyframe
+    {
+        int frame;
+        QuadDouble cx, cy;
+        double zoom;
+        int iterations;
+    };
+
+    // ------------------
+    // blank lines and lines starting with # are skipped
+    std::vector <Keyframe> readKeyframes(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in) {
+            throw std::runtime_error("Cannot open " + path + "\n");
+        }
+
+        std::vector <Keyframe> keys;
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string cx, cy;
+            Keyframe key;
+
+            if (line.find_first_not_of(" \t\r") == std::string::npos ||
+                line[line.find_first_not_of(" \t\r")] == '#') {
+                continue;
+            }
+            if (!(fields >> key.frame >> cx >> cy >> key.zoom >> key.iterations) ||
+                key.zoom <= 0 || key.iterations <= 0 ||
+                (!keys.empty() && key.frame <= keys.back().frame)) {
+                throw std::runtime_error("Bad keyframe: " + line + "\n");
+            }
+            key.cx = QuadDouble::fromString(cx);
+            key.cy = QuadDouble::fromString(cy);
+            keys.push_back(key);
+        }
+
+        if (keys.empty()) {
+            throw std::runtime_error("No keyframes in " + path + "\n");
+        }
+        return keys;
+    }
+
+    // ------------------
+    // the zoom changes by the same factor every frame, and the center
+    // moves so that the point at the center of the next keyframe
+    // stays still on screen while the zoom goes towards it
+    void interpolate(const std::vector <Keyframe> &keys, const int frame, CPU::View &view)
+    {
+        std::size_t k = 0;
+        while (k + 2 < keys.size() && keys[k + 1].frame <= frame) {
+            ++k;
+        }
+
+        const Keyframe &a = keys[k],
+                       &b = keys[std::min(k + 1, keys.size() - 1)];
+        const double t = b.frame == a.frame ? 0 :
+                         std::min(std::max(static_cast <double>(frame - a.frame) /
+                                           (b.frame - a.frame), 0.0), 1.0);
+
+        view.zoom = a.zoom * std::pow(b.zoom / a.zoom, t);
+        view.iterations = static_cast <int>(std::lround(a.iterations +
+                                                        (b.iterations - a.iterations) * t));
+
+        const double w = a.zoom == b.zoom ? 1 - t :
+                         (1 / view.zoom - 1 / b.zoom) / (1 / a.zoom - 1 / b.zoom);
+        view.cx = b.cx + (a.cx - b.cx) * QuadDouble(w);
+        view.cy = b.cy + (a.cy - b.cy) * QuadDouble(w);
+    }
+
+    std::string framePath(const std::string &pattern, const int frame)
+    {
+        std::vector <char> path(pattern.size() + 32);
+        std::snprintf(path.data(), path.size(), pattern.c_str(), frame);
+        return path.data();
+    }
+
+    // ------------------
+    // counts file, written with -d and read with -r: MAGIC, then width,
+    // height, iterations and exponent as 32 bit integers and the escape
+    // radius as a double, then for every row its counts (32 bit
+    // integers) followed by its magnitudes (32 bit floats), all in the
+    // byte order of the machine
+    const char COUNTS_MAGIC[4] = {'M', 'C', 'T', '1'};
+
+    class CountWriter
+    {
+    public:
+        CountWriter(const std::string &path, const CPU::View &image, const FractalVariant &variant)
+            : out(path, std::ios::binary)
+        {
+            if (!out) {
+                throw std::runtime_error("Cannot open " + path + " for writing\n");
+            }
+
+            const std::int32_t header[4] = {image.width, image.height, image.iterations,
+                                            variant.power};
+            const double radius = variant.escapeRadius();
+            out.write(COUNTS_MAGIC, sizeof(COUNTS_MAGIC));
+            out.write(reinterpret_cast <const char *>(header), sizeof(header));
+            out.write(reinterpret_cast <const char *>(&radius), sizeof(radius));
+        }
+
+        void writeRows(const CPU::Frame &frame, const int rows)
+        {
+            const std::size_t width = frame.width;
+            for (int row = 0; row < rows; ++row) {
+                out.write(reinterpret_cast <const char *>(&frame.iterations[row * width]),
+                          width * sizeof(std::int32_t));
+                out.write(reinterpret_cast <const char *>(&frame.magnitudes[row * width]),
+                          width * sizeof(float));
+            }
+        }
+
+        void finish()
+        {
+            out.flush();
+            if (!out) {
+                throw std::runtime_error("CountWriter: write failed\n");
+            }
+        }
+
+    private:
+        std::ofstream out;
+    };
+
+    class CountReader
+    {
+    public:
+        int width = 0,
+            height = 0,
+            iterations = 0,
+            power = 2;
+        double radius = 2;
+
+        explicit CountReader(const std::string &path)
+            : in(path, std::ios::binary)
+        {
+            char magic[sizeof(COUNTS_MAGIC)];
+            std::int32_t header[4];
+            in.read(magic, sizeof(magic));
+            in.read(reinterpret_cast <char *>(header), sizeof(header));
+            in.read(reinterpret_cast <char *>(&radius), sizeof(radius));
+
+            if (!in || std::memcmp(magic, COUNTS_MAGIC, sizeof(magic)) ||
+                header[0] <= 0 || header[1] <= 0 || header[2] <= 0 || header[3] <= 0) {
+                throw std::runtime_error(path + " is not a counts file\n");
+            }
+            width = header[0];
+            height = header[1];
+            iterations = header[2];
+            power = header[3];
+            rows_start = in.tellg();
+        }
+
+        // ------------------
+        // the next rows, into a frame of width x rows pixels
+        void readRows(CPU::Frame &frame, const int rows)
+        {
+            const std::size_t row_width = frame.width;
+            for (int row = 0; row < rows; ++row) {
+                in.read(reinterpret_cast <char *>(&frame.iterations[row * row_width]),
+                        row_width * sizeof(std::int32_t));
+                in.read(reinterpret_cast <char *>(&frame.magnitudes[row * row_width]),
+                        row_width * sizeof(float));
+            }
+            if (!in) {
+                throw std::runtime_error("CountReader: the file is cut short\n");
+            }
+        }
+
+        void rewind()
+        {
+            in.clear();
+            in.seekg(rows_start);
+        }
+
+    private:
+        std::ifstream in;
+        std::streampos rows_start;
+    };
+};
+
+int main(int argc, char **argv)
+{
+    CPU::View view;
+    CPU::DeepView deep_view;
+    bool perturbation = false,
+         tiled = false;
+    std::size_t cache_megabytes = 256,
+                spill_megabytes = 1024;
+    std::string spill_path,
+                keyframes,
+                counts_path,
+                recolor_path,
+                worker_of;
+    int workers = 0,
+        listen_port = -1;
+    int band_rows = 0;
+    std::string output = "mandelbrot.ppm";
+    unsigned threads = std::thread::hardware_concurrency();
+    CPU::RenderOptions options;
+    CPU::ColorOptions color;
+    CPU::AntiAliasOptions antialias;
+    antialias.max_samples = 1;
+    bool auto_precision = true;
+
+    for (int a = 1; a + 1 < argc; a += 2) {
+        const char *key = argv[a],
+                   *value = argv[a + 1];
+
+        if (!std::strcmp(key, "-o"))      output = value;
+        else if (!std::strcmp(key, "-w")) view.width = std::atoi(value);
+        else if (!std::strcmp(key, "-h")) view.height = std::atoi(value);
+        else if (!std::strcmp(key, "-x")) deep_view.cx = value;
+        else if (!std::strcmp(key, "-y")) deep_view.cy = value;
+        else if (!std::strcmp(key, "-z")) view.zoom = std::atof(value);
+        else if (!std::strcmp(key, "-i")) view.iterations = std::atoi(value);
+        else if (!std::strcmp(key, "-t")) threads = std::atoi(value);
+        else if (!std::strcmp(key, "-M")) cache_megabytes = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(key, "-S")) spill_path = value;
+        else if (!std::strcmp(key, "-D")) spill_megabytes = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(key, "-b")) band_rows = std::atoi(value);
+        else if (!std::strcmp(key, "-K")) keyframes = value;
+        else if (!std::strcmp(key, "-d")) counts_path = value;
+        else if (!std::strcmp(key, "-r")) recolor_path = value;
+        else if (!std::strcmp(key, "-a")) antialias.max_samples = std::atoi(value);
+        else if (!std::strcmp(key, "-N")) workers = std::atoi(value);
+        else if (!std::strcmp(key, "-L")) listen_port = std::atoi(value);
+        else if (!std::strcmp(key, "-W")) worker_of = value;
+        else if (!std::strcmp(key, "-P")) {
+            if (!CPU::parsePalette(value, color.palette)) {
+                std::cout << "Unknown palette " << value << '\n';
+                return 1;
+            }
+        }
+        else if (!std::strcmp(key, "-e")) {
+            if (!std::strcmp(value, "on"))
+                color.equalize = true;
+            else if (!std::strcmp(value, "off"))
+                color.equalize = false;
+            else {
+                std::cout << "-e takes on or off\n";
+                return 1;
+            }
+        }
+        else if (!std::strcmp(key, "-k")) {
+            if (!CPU::parseIsa(value, options.isa)) {
+                std::cout << "Unknown kernel " << value << '\n';
+                return 1;
+            }
+            if (!CPU::isaSupported(options.isa)) {
+                std::cout << "This CPU cannot run the " << CPU::isaName(options.isa)
+                          << " kernel\n";
+                return 1;
+            }
+        }
+        else if (!std::strcmp(key, "-p")) {
+            auto_precision = false;
+            if (!std::strcmp(value, "float"))
+                options.precision = CPU::Precision::Float;
+            else if (!std::strcmp(value, "double"))
+                options.precision = CPU::Precision::Double;
+            else if (!std::strcmp(value, "dd"))
+                options.precision = CPU::Precision::DoubleDouble;
+            else if (!std::strcmp(value, "qd"))
+                options.precision = CPU::Precision::QuadDouble;
+            else if (!std::strcmp(value, "auto"))
+                auto_precision = true;
+            else {
+                std::cout << "Unknown precision " << value << '\n';
+                return 1;
+            }
+        }
+        else if (!std::strcmp(key, "-f")) {
+            if (!std::strcmp(value, "mandelbrot"))
+                options.variant.formula = Formula::Mandelbrot;
+            else if (!std::strcmp(value, "burning-ship"))
+                options.variant.formula = Formula::BurningShip;
+            else if (!std::strcmp(value, "julia"))
+                options.variant.formula = Formula::Julia;
+            else {
+                std::cout << "Unknown formula " << value << '\n';
+                return 1;
+            }
+        }
+        else if (!std::strcmp(key, "-n")) {
+            options.variant.power = std::atoi(value);
+            if (options.variant.power < FractalVariant::MIN_POWER ||
+                options.variant.power > FractalVariant::MAX_POWER) {
+                std::cout << "The power must be between " << FractalVariant::MIN_POWER
+                          << " and " << FractalVariant::MAX_POWER << '\n';
+                return 1;
+            }
+        }
+        else if (!std::strcmp(key, "-j")) {
+            if (std::sscanf(value, "%lf,%lf", &options.variant.julia_re,
+                            &options.variant.julia_im) != 2) {
+                std::cout << "-j takes re,im\n";
+                return 1;
+            }
+        }
+        else if (!std::strcmp(key, "-s")) {
+            if (!std::strcmp(value, "on"))
+                options.variant.smooth = color.smooth = true;
+            else if (!std::strcmp(value, "off"))
+                options.variant.smooth = color.smooth = false;
+            else {
+                std::cout << "-s takes on or off\n";
+                return 1;
+            }
+        }
+        else if (!std::strcmp(key, "-c")) {
+            if (!std::strcmp(value, "on"))
+                options.interior_checks = true;
+            else if (!std::strcmp(value, "off"))
+                options.interior_checks = false;
+            else {
+                std::cout << "-c takes on or off\n";
+                return 1;
+            }
+        }
+        else if (!std::strcmp(key, "-m")) {
+            perturbation = !std::strcmp(value, "perturbation");
+            tiled = !std::strcmp(value, "tiled");
+            options.subdivide = !std::strcmp(value, "subdivide");
+
+            if (!perturbation && !tiled && !options.subdivide && std::strcmp(value, "direct")) {
+                std::cout << "Unknown mode " << value << '\n';
+                return 1;
+            }
+        }
+        else {
+            std::cout << "Unknown option " << key << '\n';
+            return 1;
+        }
+    }
+
+    if (!worker_of.empty()) {
+        try {
+            CPU::runWorker(worker_of, std::max(threads, 1u), options.isa);
+        }
+        catch (std::exception &e) {
+            std::cout << "ERROR::RENDER\n" << e.what() << '\n';
+            return 1;
+        }
+        return 0;
+    }
+
+    const bool distributed = workers > 0 || listen_port >= 0;
+
+    if (view.width <= 0 || view.height <= 0 || view.iterations <= 0) {
+        std::cout << "Width, height and iterations must be positive\n";
+        return 1;
+    }
+
+    if ((perturbation || tiled) && !options.variant.isDefault()) {
+        std::cout << "The perturbation and tiled modes render the default variant only\n";
+        return 1;
+    }
+
+    if (options.subdivide && !options.variant.isPlainMandelbrot()) {
+        std::cout << "The subdivide mode renders z^2 + c only\n";
+        return 1;
+    }
+
+    if (antialias.max_samples < 1) {
+        std::cout << "-a takes at least 1 sample\n";
+        return 1;
+    }
+
+    if (tiled && !counts_path.empty()) {
+        std::cout << "The tiled mode keeps no |z| to save with -d\n";
+        return 1;
+    }
+
+    if (distributed && (perturbation || tiled)) {
+        std::cout << "Workers render the direct or subdivide mode\n";
+        return 1;
+    }
+
+    if (perturbation && antialias.max_samples > 1) {
+        std::cout << "The perturbation mode does not anti-alias\n";
+        return 1;
+    }
+
+    if (perturbation && !keyframes.empty()) {
+        std::cout << "The perturbation mode renders single views\n";
+        return 1;
+    }
+
+    try {
+        CPU::Renderer renderer(threads, options);
+        CPU::PerturbationRenderer deep(renderer.threadPool());
+        CPU::AntiAliaser antialiaser(renderer.threadPool(), options, antialias);
+        std::unique_ptr <CPU::DistributedRenderer> cluster;
+        std::unique_ptr <TileCache> cache;
+        std::unique_ptr <CPU::TiledRenderer> tiles;
+        CPU::Frame frame;
+
+        if (tiled) {
+            const std::size_t tile = static_cast <std::size_t>(CPU::TiledRenderer::TILE) *
+                                     CPU::TiledRenderer::TILE;
+            cache.reset(new TileCache(tile, cache_megabytes << 20, spill_path,
+                                      spill_megabytes << 20));
+            tiles.reset(new CPU::TiledRenderer(renderer.threadPool(), *cache, options));
+        }
+
+        CPU::KernelStats kernel_stats;
+        CPU::TiledStats tile_stats;
+        CPU::AntiAliasStats antialias_stats;
+        CPU::DistributedStats cluster_stats;
+        ThreadPool &pool = renderer.threadPool();
+
+        const auto rows_of = [&](const int width) {
+            return band_rows > 0 ? band_rows : std::max((1 << 22) / width, 1);
+        };
+
+        // -----------------
+        // edges of a colored band sampled again, when asked for
+        const auto antialias_band = [&](const CPU::View &band, const int first,
+                                        const CPU::ColorMap &map) {
+            if (antialias.max_samples <= 1) {
+                return;
+            }
+            antialiaser.renderOptions().precision = renderer.renderOptions().precision;
+            antialiaser.apply(band, frame, map, first);
+
+            const CPU::AntiAliasStats &s = antialiaser.lastStats();
+            antialias_stats.edges += s.edges;
+            antialias_stats.refined += s.refined;
+            antialias_stats.samples += s.samples;
+            antialias_stats.kernel += s.kernel;
+        };
+
+        // -----------------
+        // colors of a counts file, band after band; equalizing reads
+        // it twice, the first time for the histogram. With the view
+        // the counts were rendered from, the bands are anti-aliased
+        const auto recolor_file = [&](CountReader &counts, const std::string &path,
+                                      const CPU::View *image) {
+            CPU::ColorMap map(counts.iterations, counts.radius, counts.power, color);
+            const int rows = rows_of(counts.width);
+
+            if (color.equalize) {
+                CPU::Histogram histogram(counts.iterations);
+                for (int first = 0; first < counts.height; first += rows) {
+                    const int n = std::min(rows, counts.height - first);
+                    frame.resize(counts.width, n);
+                    counts.readRows(frame, n);
+                    histogram += CPU::Histogram::of(pool, frame.iterations.data(),
+                                                    frame.iterations.size(), counts.iterations);
+                }
+                map.equalize(histogram);
+                counts.rewind();
+            }
+
+            const auto writer = ImageWriter::open(path, counts.width, counts.height);
+            for (int first = 0; first < counts.height; first += rows) {
+                const int n = std::min(rows, counts.height - first);
+                frame.resize(counts.width, n);
+                counts.readRows(frame, n);
+                CPU::colorFrame(pool, frame, map);
+                if (image) {
+                    antialias_band(CPU::regionOf(*image, 0, first, image->width, n), first, map);
+                }
+                writer->writeRows(frame.rgba.data(), n);
+            }
+            writer->finish();
+        };
+
+        const bool recolor = color.palette != CPU::Palette::Classic || color.equalize;
+
+        // -----------------
+        // one image, band after band. Unless the colors are the ones
+        // of the renderers, every band goes through the color pass;
+        // to equalize an image of several bands, the histogram of all
+        // of them is needed first, so they are saved and recolored
+        // from the counts file (a temporary one without -d).
+        const auto render_image = [&](const CPU::View &image, const std::string &path,
+                                      const std::string &counts_file) {
+            if (auto_precision) {
+                renderer.renderOptions().precision = CPU::selectPrecision(image.zoom, image.height);
+            }
+
+            const int rows = rows_of(image.width);
+            const bool two_passes = color.equalize && rows < image.height;
+            const std::string saved = !counts_file.empty() ? counts_file :
+                                      two_passes ? path + ".counts" : "";
+
+            std::unique_ptr <CountWriter> counts;
+            std::unique_ptr <ImageWriter> writer;
+            if (!saved.empty()) {
+                counts.reset(new CountWriter(saved, image, options.variant));
+            }
+            if (!two_passes) {
+                writer = ImageWriter::open(path, image.width, image.height);
+            }
+            CPU::ColorMap map(image.iterations, options.variant, color);
+
+            for (int first = 0; first < image.height; first += rows) {
+                const CPU::View band = CPU::regionOf(image, 0, first, image.width,
+                                                     std::min(rows, image.height - first));
+
+                if (tiled) {
+                    tiles->render(band, frame);
+
+                    const CPU::TiledStats &s = tiles->lastStats();
+                    tile_stats.level = s.level;
+                    tile_stats.tiles += s.tiles;
+                    tile_stats.rendered += s.rendered;
+                    tile_stats.assembled += s.assembled;
+                    tile_stats.cached += s.cached;
+                }
+                else if (cluster) {
+                    cluster->renderOptions().precision = renderer.renderOptions().precision;
+                    cluster->render(band, frame);
+                    cluster_stats += cluster->lastStats();
+                    kernel_stats += cluster->lastStats().kernel;
+                }
+                else {
+                    renderer.render(band, frame);
+                    kernel_stats += renderer.lastStats();
+                }
+
+                if (counts) {
+                    counts->writeRows(frame, band.height);
+                }
+                if (!two_passes) {
+                    if (recolor) {
+                        CPU::colorize(pool, frame, map);
+                    }
+                    antialias_band(band, first, map);
+                    writer->writeRows(frame.rgba.data(), band.height);
+                }
+            }
+
+            if (counts) {
+                counts->finish();
+                counts.reset();
+            }
+            if (two_passes) {
+                CountReader reader(saved);
+                recolor_file(reader, path, &image);
+                if (counts_file.empty()) {
+                    std::remove(saved.c_str());
+                }
+            }
+            else {
+                writer->finish();
+            }
+        };
+
+        using Clock = std::chrono::steady_clock;
+        const Clock::time_point start = Clock::now();
+        double pixels = 0;
+
+        // -----------------
+        // local workers split the threads between them
+        if (distributed && recolor_path.empty()) {
+            CPU::DistributedOptions cluster_options;
+            cluster_options.magnitudes = color.smooth || !counts_path.empty();
+            cluster.reset(new CPU::DistributedRenderer(options, cluster_options));
+
+            const int port = cluster->listen(std::max(listen_port, 0), listen_port >= 0);
+            if (listen_port >= 0) {
+                std::cout << "waiting for workers on port " << port << '\n';
+            }
+            if (workers > 0) {
+                const unsigned each = std::max(threads / workers, 1u);
+                cluster->spawnWorkers(argv[0], workers, {"-t", std::to_string(each)});
+            }
+        }
+
+        if (!recolor_path.empty()) {
+            CountReader counts(recolor_path);
+            recolor_file(counts, output, nullptr);
+
+            const double seconds = std::chrono::duration <double>(Clock::now() - start).count();
+            std::cout << counts.width << 'x' << counts.height << " recolored in "
+                      << seconds * 1e3 << " ms\n";
+            return 0;
+        }
+
+        // -----------------
+        // the center is kept as text until here, so that each renderer
+        // can read it with the precision it needs
+        view.cx = QuadDouble::fromString(deep_view.cx);
+        view.cy = QuadDouble::fromString(deep_view.cy);
+
+        if (perturbation) {
+            deep_view.zoom = view.zoom;
+            deep_view.iterations = view.iterations;
+            deep_view.width = view.width;
+            deep_view.height = view.height;
+            deep.render(deep_view, frame);
+
+            if (!counts_path.empty()) {
+                CountWriter counts(counts_path, view, options.variant);
+                counts.writeRows(frame, frame.height);
+                counts.finish();
+            }
+            if (recolor) {
+                CPU::ColorMap map(view.iterations, options.variant, color);
+                CPU::colorize(pool, frame, map);
+            }
+
+            const auto writer = ImageWriter::open(output, frame.width, frame.height);
+            writer->writeRows(frame.rgba.data(), frame.height);
+            writer->finish();
+            pixels = static_cast <double>(view.width) * view.height;
+
+            const CPU::PerturbationStats &stats = deep.lastStats();
+            std::cout << "reference orbit: " << stats.reference_length
+                      << " points, series skipped " << stats.skipped_iterations
+                      << " iterations, " << stats.rebases << " rebases\n";
+        }
+        else if (!keyframes.empty()) {
+            const std::vector <Keyframe> keys = readKeyframes(keyframes);
+
+            for (int f = keys.front().frame; f <= keys.back().frame; ++f) {
+                const Clock::time_point frame_start = Clock::now();
+                interpolate(keys, f, view);
+                render_image(view, framePath(output, f),
+                             counts_path.empty() ? "" : framePath(counts_path, f));
+
+                const double seconds = std::chrono::duration <double>(Clock::now() - frame_start).count(),
+                             frame_pixels = static_cast <double>(view.width) * view.height;
+                pixels += frame_pixels;
+                std::cout << "frame " << f << ": zoom " << view.zoom << ", "
+                          << view.iterations << " iterations, "
+                          << frame_pixels / seconds / 1e6 << " Mpixel/s\n";
+            }
+        }
+        else {
+            if (!tiled) {
+                std::cout << "precision: " << CPU::precisionName(
+                    auto_precision ? CPU::selectPrecision(view.zoom, view.height) : options.precision)
+                          << '\n';
+            }
+            render_image(view, output, counts_path);
+            pixels = static_cast <double>(view.width) * view.height;
+        }
+
+        if (tiled) {
+            std::cout << "level " << tile_stats.level << ": " << tile_stats.tiles << " tiles, "
+                      << tile_stats.rendered << " rendered, " << tile_stats.assembled
+                      << " assembled from finer ones, " << tile_stats.cached << " cached\n";
+        }
+        else if (!perturbation) {
+            std::cout << "iterations: " << kernel_stats.iterations
+                      << ", saved by the cardioid / bulb test: " << kernel_stats.cardioid_saved
+                      << ", saved by periodicity checking: " << kernel_stats.periodicity_saved
+                      << ", pixels filled: " << kernel_stats.filled << '\n';
+        }
+        if (cluster) {
+            std::cout << "workers: " << cluster_stats.workers << ", " << cluster_stats.tiles
+                      << " tiles, " << cluster_stats.stolen << " stolen, " << cluster_stats.backups
+                      << " backed up, " << cluster_stats.requeued << " requeued, "
+                      << cluster_stats.duplicates << " duplicates; "
+                      << cluster_stats.received_bytes / 1024 << " KiB received for "
+                      << cluster_stats.raw_bytes / 1024 << " KiB of counts\n";
+        }
+        if (antialias.max_samples > 1) {
+            std::cout << "anti-aliasing: " << antialias_stats.edges << " edge pixels, "
+                      << antialias_stats.refined << " of them sampled up to "
+                      << antialias.max_samples << " times, " << antialias_stats.samples
+                      << " samples added\n";
+        }
+
+        const double seconds = std::chrono::duration <double>(Clock::now() - start).count();
+        std::cout << pixels / 1e6 << " Mpixel in " << seconds << " s, "
+                  << pixels / seconds / 1e6 << " Mpixel/s\n";
+    }
+    catch (std::exception &e) {
+        std::cout << "ERROR::RENDER\n" << e.what() << '\n';
+        return 1;
+    }
+
+    return 0;
+}
@@ -3,7 +3,16 @@
    Modified by Tihran Katolikian 06.07.2018
    Updates:
    - code style changed;
-   - member values incapsulated, getters and setters created;*/
+   - member values incapsulated, getters and setters created;
+   - uniform locations cached at link time, setters taking a resolved
+     Uniform handle, missing uniforms reported;
+   - std140 uniform blocks backed by a UniformBuffer;
+   - preprocessor definitions injected after #version, and a cache of
+     the programs compiled for every set of them (ShaderVariants);
+   - files read by ShaderSource, on another thread if asked, missing
+     files reported as errors instead of compiled empty;
+   - linked programs saved to and loaded from a ProgramCache, and
+     reloaded when their files change.*/
 
 #ifndef SHADER_HPP
 #define SHADER_HPP
@@ -16,119 +25,256 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
-class Shader
+#include "program_cache.hpp"
+
+// ------------------------
+// buffer behind a uniform block of std140 layout; Block must match
+// the block member for member, padding included
+template <class Block>
+class UniformBuffer
 {
 public:
-    // ------------------------
-    // constructor generates the shader on the fly
-    Shader(const char *vs_name, const char *fs_name, const char *gs_name = nullptr)
+    explicit UniformBuffer(const unsigned binding_point)
+        : binding(binding_point)
     {
-        std::string vs_code;
-        std::string fs_code;
-        std::string gs_code;
-        
-        std::ifstream vs_source;
-        std::ifstream fs_source;
-        std::ifstream gs_source;
-        
-        // --------------------------
-        // ensure ifstream objects can throw exceptions:
-        vs_source.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fs_source.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        gs_source.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try {
-            // ---------------------
-            // open files
-            vs_source.open(std::string("shaders/") + vs_name);
-            fs_source.open(std::string("shaders/") + fs_name);
-            
-            std::stringstream vs_stream, fs_stream;
-            
-            // --------------------------
-            // read file's buffer contents into streams
-            vs_stream << vs_source.rdbuf();
-            fs_stream << fs_source.rdbuf();	
-
-            // --------------------
-            // close file handlers
-            vs_source.close();
-            fs_source.close();
-            
-            // ------------------- 
-            // convert stream into string
-            vs_code = vs_stream.str();
-            fs_code = fs_stream.str();			
-            
-            // -------------------
-            // if geometry shader path is present, also load a geometry shader
-            if(gs_name != nullptr) {
-                gs_source.open(std::string("shaders") + gs_name);
-                std::stringstream gs_stream;
-                gs_stream << gs_source.rdbuf();
-                gs_source.close();
-                gs_code = gs_stream.str();
-            }
-        }
-        catch (std::ifstream::failure &e) {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ\n"
-                      << e.what() << '\n';
-        }
+        glGenBuffers(1, &id);
+        glBindBuffer(GL_UNIFORM_BUFFER, id);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, id);
+    }
+    
+    UniformBuffer(const UniformBuffer &) = delete;
+    UniformBuffer &operator=(const UniformBuffer &) = delete;
+    
+    ~UniformBuffer()
+    {
+        glDeleteBuffers(1, &id);
+    }
+    
+    // --------------------
+    // all members in one call
+    void upload(const Block &block) const
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, id);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+    }
+    
+    unsigned getBinding() const
+    {
+        return binding;
+    }
 
-        // --------------------
-        // compile shaders
-        unsigned int vertex, fragment;
+private:
+    unsigned id,
+             binding;
+};
 
-        // --------------
-        // vertex shader
-        const GLchar *vs_str = vs_code.c_str();
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vs_str, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, VERTEX);
-        
-        // --------------
-        // fragment Shader
-        const GLchar *fs_str = fs_code.c_str();
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fs_str, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, FRAGMENT);
-        
-        // -----------------------
-        // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
+// ------------------------
+// code of the stages of a program, read from shaders/ with the
+// definitions injected after #version. Reading may run on another
+// thread (loadAsync()); given a cache, the stored binary of the
+// program, if there is one, is read along.
+struct ShaderSource
+{
+    std::string vs_name,
+                fs_name,
+                gs_name;
+    std::vector <std::string> defines;
+    
+    std::string vs_code,
+                fs_code,
+                gs_code;
+    std::uint64_t key = 0;
+    std::vector <char> binary;
+    
+    // --------------------
+    // of the files when they were read
+    std::vector <std::filesystem::file_time_type> times;
+    
+    // --------------------
+    // no geometry shader if gs is empty; throws if a file cannot be
+    // read
+    static ShaderSource load(const std::string &vs, const std::string &fs, const std::string &gs,
+                             const std::vector <std::string> &defines,
+                             const ProgramCache *cache = nullptr)
+    {
+        ShaderSource source;
+        source.vs_name = vs;
+        source.fs_name = fs;
+        source.gs_name = gs;
+        source.defines = defines;
+        source.times = source.fileTimes();
         
-        if (gs_name != nullptr) {
-            const GLchar *gs_str = gs_code.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gs_str, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, GEOMETRY);
+        source.vs_code = injectDefines(readFile(vs), defines);
+        source.fs_code = injectDefines(readFile(fs), defines);
+        if (!gs.empty()) {
+            source.gs_code = injectDefines(readFile(gs), defines);
         }
         
-        // ------------------
-        // shader Program
-        id = glCreateProgram();
-        glAttachShader(id, vertex);
-        glAttachShader(id, fragment);
+        if (cache) {
+            source.key = cache->keyOf({source.vs_code, source.fs_code, source.gs_code});
+            source.binary = cache->read(source.key);
+        }
+        return source;
+    }
+    
+    static std::future <ShaderSource> loadAsync(const std::string &vs, const std::string &fs,
+                                                const std::string &gs,
+                                                const std::vector <std::string> &defines,
+                                                const ProgramCache *cache = nullptr)
+    {
+        return std::async(std::launch::async, [=]() {
+            return load(vs, fs, gs, defines, cache);
+        });
+    }
+    
+    // --------------------
+    // one of the files was written since it was read
+    bool changed() const
+    {
+        return fileTimes() != times;
+    }
+    
+    // --------------------
+    // GLSL wants #version before anything else
+    static std::string injectDefines(const std::string &code,
+                                     const std::vector <std::string> &defines)
+    {
+        if (defines.empty() || code.empty()) {
+            return code;
+        }
         
-        if (gs_name != nullptr)
-            glAttachShader(id, geometry);
+        std::string lines;
+        for (const std::string &define : defines) {
+            lines += "#define " + define + '\n';
+        }
         
-        glLinkProgram(id);
-        checkCompileErrors(id, PROGRAM);
+        const std::size_t version = code.find("#version");
+        if (version == std::string::npos) {
+            return lines + code;
+        }
+        const std::size_t end = code.find('\n', version);
+        if (end == std::string::npos) {
+            return code + '\n' + lines;
+        }
+        return code.substr(0, end + 1) + lines + code.substr(end + 1);
+    }
+
+private:
+    static std::string readFile(const std::string &name)
+    {
+        std::ifstream file(std::string("shaders/") + name);
+        std::stringstream stream;
+        stream << file.rdbuf();
         
-        // -----------------------
-        // delete the shaders as they're linked into our program now
-        // and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (gs_name != nullptr)
-            glDeleteShader(geometry);
+        if (!file) {
+            throw std::runtime_error("ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ shaders/" +
+                                     name + "\n");
+        }
+        return stream.str();
+    }
+    
+    std::vector <std::filesystem::file_time_type> fileTimes() const
+    {
+        std::vector <std::filesystem::file_time_type> result;
+        for (const std::string *name : {&vs_name, &fs_name, &gs_name}) {
+            std::error_code error;
+            result.push_back(name->empty() ? std::filesystem::file_time_type() :
+                             std::filesystem::last_write_time("shaders/" + *name, error));
+        }
+        return result;
+    }
+};
+
+class Shader
+{
+public:
+    // ------------------------
+    // constructor generates the shader on the fly; every line of
+    // defines becomes a #define of every stage, right after #version
+    Shader(const char *vs_name, const char *fs_name, const char *gs_name = nullptr,
+           const std::vector <std::string> &defines = {}, ProgramCache *program_cache = nullptr)
+        : Shader(ShaderSource::load(vs_name, fs_name, gs_name ? gs_name : "", defines,
+                                    program_cache),
+                 program_cache)
+    {}
+    
+    // ------------------------
+    // from sources read beforehand; with a cache, the stored binary
+    // is used if the driver takes it, else the program is compiled
+    // and its binary stored
+    explicit Shader(ShaderSource shader_source, ProgramCache *program_cache = nullptr)
+        : source(std::move(shader_source)), cache(program_cache)
+    {
+        bool linked;
+        id = build(source, linked);
+        cacheUniforms();
+    }
+    
+    Shader(const Shader &) = delete;
+    Shader &operator=(const Shader &) = delete;
+    
+    ~Shader()
+    {
+        glDeleteProgram(id);
     }
     
-    ~Shader() = default;
+    // --------------------
+    // hot reload, to be called once in a while: when a file changed,
+    // the files are read again on another thread and a later call
+    // swaps in the new program, if it links. Returns true when the
+    // program changed; uniforms outside of blocks then need to be set
+    // again.
+    bool reload()
+    {
+        if (pending.valid()) {
+            if (pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                return false;
+            }
+            
+            ShaderSource next;
+            try {
+                next = pending.get();
+            }
+            catch (std::exception &e) {
+                std::cout << e.what();
+                return false;
+            }
+            
+            bool linked;
+            const unsigned program = build(next, linked);
+            source = std::move(next);
+            if (!linked) {
+                glDeleteProgram(program);
+                return false;
+            }
+            
+            glDeleteProgram(id);
+            id = program;
+            uniforms.clear();
+            reported.clear();
+            cacheUniforms();
+            return true;
+        }
+        
+        if (source.changed()) {
+            pending = ShaderSource::loadAsync(source.vs_name, source.fs_name, source.gs_name,
+                                              source.defines, cache);
+        }
+        return false;
+    }
     
     // --------------------
     // activate the shader
@@ -137,22 +283,81 @@ public:
         glUseProgram(id); 
     }
     
+    // ------------------------
+    // location of a uniform, found once with uniform(); the setters
+    // that take it neither look it up nor allocate
+    struct Uniform
+    {
+        int location = -1;
+    };
+    
+    // ------------------------
+    // a uniform the program does not have (or that the compiler
+    // dropped as unused) is reported once, its handle does nothing
+    Uniform uniform(const std::string &name) const
+    {
+        const auto found = uniforms.find(name);
+        if (found != uniforms.end()) {
+            return Uniform {found->second};
+        }
+        
+        if (reported.insert(name).second) {
+            std::cout << "ERROR::SHADER::UNIFORM_NOT_FOUND " << name << '\n';
+        }
+        return Uniform();
+    }
+    
+    // ------------------------
+    // binds the uniform block to the binding point of buffer, checking
+    // that they have the same size
+    template <class Block>
+    bool bindBlock(const std::string &name, const UniformBuffer <Block> &buffer) const
+    {
+        const unsigned index = glGetUniformBlockIndex(id, name.c_str());
+        if (index == GL_INVALID_INDEX) {
+            std::cout << "ERROR::SHADER::UNIFORM_BLOCK_NOT_FOUND " << name << '\n';
+            return false;
+        }
+        
+        int size = 0;
+        glGetActiveUniformBlockiv(id, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+        if (size != static_cast <int>(sizeof(Block))) {
+            std::cout << "ERROR::SHADER::UNIFORM_BLOCK_SIZE " << name << ": " << size
+                      << " bytes in the shader, " << sizeof(Block) << " in the buffer\n";
+            return false;
+        }
+        
+        glUniformBlockBinding(id, index, buffer.getBinding());
+        return true;
+    }
+    
     // ---------------------------
     // utility uniform functions
+    void setBool(const Uniform handle, const bool value) const
+    {
+        glUniform1i(handle.location, static_cast <int>(value));
+    }
     void setBool(const std::string &name, const bool value) const
     {         
-        glUniform1i(glGetUniformLocation(id, name.c_str()),
-                    static_cast <int>(value)); 
+        setBool(uniform(name), value);
     }
     // --------------------------
+    void setInt(const Uniform handle, const int value) const
+    {
+        glUniform1i(handle.location, value);
+    }
     void setInt(const std::string &name, const int value) const
     { 
-        glUniform1i(glGetUniformLocation(id, name.c_str()), value);
+        setInt(uniform(name), value);
     }
     // --------------------------
+    void setFloat(const Uniform handle, const float value) const
+    {
+        glUniform1f(handle.location, value);
+    }
     void setFloat(const std::string &name, const float value) const
     { 
-        glUniform1f(glGetUniformLocation(id, name.c_str()), value);
+        setFloat(uniform(name), value);
     }
     
 #ifdef OPENGL_SHADER_DOUBLE_PRESISION
@@ -161,62 +366,96 @@ public:
     void setDouble(const std::string &name, const double &value)
     {
         //may not work in versions lesser then 4
-        glUniform1d(glGetUniformLocation(id, name.c_str()), value);
+        glUniform1d(uniform(name).location, value);
     }
     
     void setVec2d(const std::string &name, const double &a, const double &b)
     {
         //may not work in versions lesser then 4
-        glUniform2d(glGetUniformLocation(id, name.c_str()), a, b);
+        glUniform2d(uniform(name).location, a, b);
     }
 #endif
     
     // -------------------------
+    void setVec2(const Uniform handle, const glm::vec2 &value) const
+    {
+        glUniform2fv(handle.location, 1, &value[0]);
+    }
+    void setVec2(const Uniform handle, const float x, const float y) const
+    {
+        glUniform2f(handle.location, x, y);
+    }
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]); 
+        setVec2(uniform(name), value);
     }
     void setVec2(const std::string &name, const float x, const float y) const
     { 
-        glUniform2f(glGetUniformLocation(id, name.c_str()), x, y);
+        setVec2(uniform(name), x, y);
     }
     // -------------------------
+    void setVec3(const Uniform handle, const glm::vec3 &value) const
+    {
+        glUniform3fv(handle.location, 1, &value[0]);
+    }
+    void setVec3(const Uniform handle, const float x, const float y, const float z) const
+    {
+        glUniform3f(handle.location, x, y, z);
+    }
     void setVec3(const std::string &name, const glm::vec3 &value) const
     {
-        glUniform3fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
+        setVec3(uniform(name), value);
     }
     void setVec3(const std::string &name, const float x, 
                  const float y, const float z) const
     {
-        glUniform3f(glGetUniformLocation(id, name.c_str()), x, y, z);
+        setVec3(uniform(name), x, y, z);
     }
     // -------------------------
+    void setVec4(const Uniform handle, const glm::vec4 &value) const
+    {
+        glUniform4fv(handle.location, 1, &value[0]);
+    }
+    void setVec4(const Uniform handle, const float x, const float y,
+                 const float z, const float w) const
+    {
+        glUniform4f(handle.location, x, y, z, w);
+    }
     void setVec4(const std::string &name, const glm::vec4 &value) const
     {
-        glUniform4fv(glGetUniformLocation(id, name.c_str()), 1, &value[0]);
+        setVec4(uniform(name), value);
     }
     void setVec4(const std::string &name, const float x, const float y,
                  const float z, const float w) 
     {
-        glUniform4f(glGetUniformLocation(id, name.c_str()), x, y, z, w); 
+        setVec4(uniform(name), x, y, z, w);
     }
     // -------------------------
+    void setMat2(const Uniform handle, const glm::mat2 &mat) const
+    {
+        glUniformMatrix2fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+    }
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(id, name.c_str()), 1,
-                           GL_FALSE, &mat[0][0]);
+        setMat2(uniform(name), mat);
     }
     // -------------------------
+    void setMat3(const Uniform handle, const glm::mat3 &mat) const
+    {
+        glUniformMatrix3fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+    }
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(id, name.c_str()), 1,
-                           GL_FALSE, &mat[0][0]);
+        setMat3(uniform(name), mat);
     }
     // -------------------------
+    void setMat4(const Uniform handle, const glm::mat4 &mat) const
+    {
+        glUniformMatrix4fv(handle.location, 1, GL_FALSE, &mat[0][0]);
+    }
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(id, name.c_str()), 1,
-                           GL_FALSE, &mat[0][0]);
+        setMat4(uniform(name), mat);
     }
     
     void setMVP(const glm::mat4 &m, const glm::mat4 &v, const glm::mat4 &p)
@@ -240,11 +479,22 @@ private:
     // shader program id
     unsigned int id;
     
+    ShaderSource source;
+    ProgramCache *cache;
+    std::future <ShaderSource> pending;
+    
+    // -----------------------
+    // locations of the uniforms outside of blocks, by name
+    std::unordered_map <std::string, int> uniforms;
+    mutable std::unordered_set <std::string> reported;
+    
     std::string getTypeName(const Type type) const noexcept(false)
     {
         switch(type) {
             case PROGRAM:
             return "PROGRAM";
+            case GEOMETRY:
+            return "GEOMETRY";
             case FRAGMENT:
             return "FRAGMENT";
             case VERTEX:
@@ -254,9 +504,119 @@ private:
         }
     }
     
+    // -----------------------
+    // the program of source, from the cache if it has it. Compile and
+    // link errors are reported, linked tells if there were none.
+    unsigned build(const ShaderSource &code, bool &linked) const
+    {
+        unsigned program = glCreateProgram();
+        if (cache && cache->load(program, code.key, code.binary)) {
+            linked = true;
+            return program;
+        }
+        if (cache && !code.binary.empty()) {
+            // a refused binary may leave the program in any state
+            glDeleteProgram(program);
+            program = glCreateProgram();
+        }
+        
+        const bool geometry_shader = !code.gs_name.empty();
+        
+        // --------------------
+        // compile shaders
+        unsigned int vertex, fragment;
+
+        // --------------
+        // vertex shader
+        const GLchar *vs_str = code.vs_code.c_str();
+        vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vs_str, NULL);
+        glCompileShader(vertex);
+        checkCompileErrors(vertex, VERTEX);
+        
+        // --------------
+        // fragment Shader
+        const GLchar *fs_str = code.fs_code.c_str();
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fs_str, NULL);
+        glCompileShader(fragment);
+        checkCompileErrors(fragment, FRAGMENT);
+        
+        // -----------------------
+        // if geometry shader is given, compile geometry shader
+        unsigned int geometry;
+        
+        if (geometry_shader) {
+            const GLchar *gs_str = code.gs_code.c_str();
+            geometry = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(geometry, 1, &gs_str, NULL);
+            glCompileShader(geometry);
+            checkCompileErrors(geometry, GEOMETRY);
+        }
+        
+        // ------------------
+        // shader Program
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        
+        if (geometry_shader)
+            glAttachShader(program, geometry);
+        
+        if (cache)
+            cache->prepare(program);
+        
+        glLinkProgram(program);
+        linked = checkCompileErrors(program, PROGRAM);
+        
+        // -----------------------
+        // delete the shaders as they're linked into our program now
+        // and no longer necessery
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        if (geometry_shader)
+            glDeleteShader(geometry);
+        
+        if (linked && cache)
+            cache->store(program, code.key);
+        return program;
+    }
+    
+    // -----------------------
+    // reads every active uniform once the program is linked. Members
+    // of uniform blocks have no location and are skipped; arrays are
+    // also found without their "[0]"
+    void cacheUniforms()
+    {
+        int count = 0,
+            max_length = 0;
+        glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+        
+        std::vector <char> name(max_length + 1);
+        for (int i = 0; i < count; ++i) {
+            int length = 0,
+                size = 0;
+            GLenum type;
+            glGetActiveUniform(id, i, static_cast <int>(name.size()), &length, &size, &type,
+                               name.data());
+            
+            const std::string uniform_name(name.data(), length);
+            const int location = glGetUniformLocation(id, uniform_name.c_str());
+            if (location < 0) {
+                continue;
+            }
+            
+            uniforms[uniform_name] = location;
+            if (uniform_name.size() > 3 &&
+                uniform_name.compare(uniform_name.size() - 3, 3, "[0]") == 0) {
+                uniforms[uniform_name.substr(0, uniform_name.size() - 3)] = location;
+            }
+        }
+    }
+    
     // -----------------------
     // utility function for checking shader compilation/linking errors.
-    void checkCompileErrors(const unsigned shader, const Type type)
+    bool checkCompileErrors(const unsigned shader, const Type type) const
     {
         int success;
         char info_log[1024];
@@ -279,6 +639,108 @@ private:
                           << "\n-------------------------------------\n";
             }
         }
+        return success != 0;
+    }
+};
+
+// ------------------------
+// programs of one pair of sources compiled with different definitions,
+// each compiled the first time it is asked for and kept, so switching
+// back to a variant costs nothing
+class ShaderVariants
+{
+public:
+    // ------------------------
+    // setup is run once on every new program, for what a program
+    // keeps of its own (uniform block bindings, sampler units)
+    ShaderVariants(const char *vs, const char *fs,
+                   const std::function <void(Shader &)> &setup = nullptr,
+                   ProgramCache *program_cache = nullptr)
+        : vs_name(vs), fs_name(fs), on_compile(setup), cache(program_cache)
+    {}
+    
+    // ------------------------
+    // starts reading the files of a variant on another thread, for a
+    // get() to come
+    void prefetch(const std::string &key, const std::vector <std::string> &defines)
+    {
+        if (!programs.count(key) && !loading.count(key)) {
+            loading[key] = ShaderSource::loadAsync(vs_name, fs_name, "", defines, cache);
+        }
+    }
+    
+    // ------------------------
+    // key must differ for different defines; throws if the files
+    // cannot be read
+    Shader &get(const std::string &key, const std::vector <std::string> &defines)
+    {
+        std::unique_ptr <Shader> &program = programs[key];
+        if (!program) {
+            prefetch(key, defines);
+            std::future <ShaderSource> source = std::move(loading[key]);
+            loading.erase(key);
+            
+            try {
+                program.reset(new Shader(source.get(), cache));
+            }
+            catch (...) {
+                programs.erase(key);
+                throw;
+            }
+            if (times.empty()) {
+                times = fileTimes();
+            }
+            if (on_compile) {
+                on_compile(*program);
+            }
+        }
+        last_key = key;
+        last_defines = defines;
+        return *program;
+    }
+    
+    // ------------------------
+    // to be called once in a while: when a file changed, drops every
+    // program and returns true, references from get() are then gone.
+    // The files of the last variant are read again meanwhile.
+    bool reload()
+    {
+        if (times.empty() || fileTimes() == times) {
+            return false;
+        }
+        
+        times.clear();
+        programs.clear();
+        loading.clear();
+        prefetch(last_key, last_defines);
+        return true;
+    }
+    
+    std::size_t size() const
+    {
+        return programs.size();
+    }
+
+private:
+    std::string vs_name,
+                fs_name;
+    std::function <void(Shader &)> on_compile;
+    ProgramCache *cache;
+    std::unordered_map <std::string, std::unique_ptr <Shader>> programs;
+    std::unordered_map <std::string, std::future <ShaderSource>> loading;
+    
+    std::string last_key;
+    std::vector <std::string> last_defines;
+    std::vector <std::filesystem::file_time_type> times;
+    
+    std::vector <std::filesystem::file_time_type> fileTimes() const
+    {
+        std::vector <std::filesystem::file_time_type> result;
+        for (const std::string *name : {&vs_name, &fs_name}) {
+            std::error_code error;
+            result.push_back(std::filesystem::last_write_time("shaders/" + *name, error));
+        }
+        return result;
     }
 };
 
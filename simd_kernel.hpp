@@ -0,0 +1,631 @@
+/* Vectorized version of the iteration loop of mandelbrot.fs.
+   A kernel iterates a run of points 4, 8 or 16 at a time (2, 4 or 8
+   in double precision). Lanes that escape are masked out and the group
+   stops as soon as all of its lanes have escaped.
+
+   Every ISA is compiled into the same binary through target attributes,
+   so the Makefile needs no -m flags; detectIsa() picks the widest one
+   the CPU and the OS support at startup and kernelFor() hands out the
+   matching function, falling back to scalar code.
+
+   Interior points are the expensive ones, as they run all iterations.
+   Unless disabled, points of the main cardioid and of the period-2
+   bulb are answered analytically, and orbits that come back to a point
+   saved at the last power-of-two iteration (Brent's cycle detection)
+   are stopped early. Both only ever answer "interior", so the counts
+   stay those of the plain loop.
+
+   Smooth coloring wants points to escape past a larger radius, 256
+   instead of 2 (FractalVariant::escapeRadius()); every kernel comes
+   with either radius.*/
+
+#ifndef SIMD_KERNEL_HPP
+#define SIMD_KERNEL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_X86_SIMD
+#include <immintrin.h>
+
+// ------------------
+// the lane helpers are plain inline functions with a target attribute;
+// a flattened kernel with the same target inlines all of them, so the
+// generic loop below is compiled once per ISA
+#define CPU_TARGET(isa) __attribute__((target(isa)))
+#define CPU_KERNEL(isa) __attribute__((target(isa), flatten))
+
+// the generic loop passes vectors by value before it is inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace CPU
+{
+    enum class Isa {Scalar, SSE2, AVX2, AVX512};
+
+    // ------------------
+    // counters of kernel calls, summed up per frame by the renderers
+    struct KernelStats
+    {
+        // iterations actually executed
+        std::uint64_t iterations = 0;
+        // iterations skipped by the cardioid / bulb test
+        std::uint64_t cardioid_saved = 0;
+        // iterations skipped by periodicity checking
+        std::uint64_t periodicity_saved = 0;
+        // pixels the caller filled in without calling a kernel
+        std::uint64_t filled = 0;
+
+        KernelStats &operator+=(const KernelStats &other)
+        {
+            iterations += other.iterations;
+            cardioid_saved += other.cardioid_saved;
+            periodicity_saved += other.periodicity_saved;
+            filled += other.filled;
+            return *this;
+        }
+    };
+
+    // ------------------
+    // escape-time kernel: writes to out[k] the number of iterations c[k]
+    // completes before |z|^2 goes over 4 (65536 for the smooth ones),
+    // capped at iterations. Unless
+    // they are null, zr[k] and zi[k] receive the last z of every point:
+    // for one that did not escape, the z its orbit can be resumed
+    // from later; for one that did, the first z past the radius, which
+    // smooth coloring needs.
+    template <class Real>
+    using Kernel = void (*)(const Real *cr, const Real *ci, int count,
+                            int iterations, int *out, Real *zr, Real *zi,
+                            KernelStats &stats);
+
+    inline const char *isaName(const Isa isa)
+    {
+        switch (isa) {
+            case Isa::SSE2:
+            return "sse2";
+            case Isa::AVX2:
+            return "avx2";
+            case Isa::AVX512:
+            return "avx512";
+            default:
+            return "scalar";
+        }
+    }
+
+    inline bool parseIsa(const std::string &name, Isa &isa)
+    {
+        for (const Isa candidate : {Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::AVX512}) {
+            if (name == isaName(candidate)) {
+                isa = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // ------------------
+    // the kernels of isa can run on this machine
+    inline bool isaSupported(const Isa isa)
+    {
+#ifdef CPU_X86_SIMD
+        __builtin_cpu_init();
+        switch (isa) {
+            case Isa::SSE2:
+            return __builtin_cpu_supports("sse2");
+            case Isa::AVX2:
+            return __builtin_cpu_supports("avx2");
+            case Isa::AVX512:
+            return __builtin_cpu_supports("avx512f");
+            default:
+            return true;
+        }
+#else
+        return isa == Isa::Scalar;
+#endif
+    }
+
+    // ------------------
+    // widest instruction set usable on this machine
+    inline Isa detectIsa()
+    {
+#ifdef CPU_X86_SIMD
+        for (const Isa isa : {Isa::AVX512, Isa::AVX2, Isa::SSE2}) {
+            if (isaSupported(isa))
+                return isa;
+        }
+#endif
+        return Isa::Scalar;
+    }
+
+    // ------------------
+    // c is in the main cardioid or in the period-2 bulb
+    template <class Real>
+    bool inCardioidOrBulb(const Real cr, const Real ci)
+    {
+        const Real x = cr - Real(0.25),
+                   y2 = ci * ci,
+                   q = x * x + y2;
+        if (q * (q + x) < Real(0.25) * y2)
+            return true;
+
+        const Real x1 = cr + Real(1);
+        return x1 * x1 + y2 < Real(0.0625);
+    }
+
+    // ------------------
+    // squared distance under which an orbit point counts as a repeat;
+    // a few ulps, so that no escaping orbit is ever caught
+    template <class Real>
+    Real periodTolerance()
+    {
+        const Real e = std::numeric_limits <Real>::epsilon() * Real(16);
+        return e * e;
+    }
+
+    // ------------------
+    // square of the escape radius
+    template <class Real, bool Smooth>
+    Real bailout()
+    {
+        return Smooth ? Real(65536) : Real(4);
+    }
+
+    namespace detail
+    {
+        template <class Real, bool Checks, bool Smooth>
+        void scalarKernel(const Real *cr, const Real *ci, const int count,
+                          const int iterations, int *out, Real *zr_out, Real *zi_out,
+                          KernelStats &stats)
+        {
+            const Real tolerance = periodTolerance <Real>(),
+                       radius2 = bailout <Real, Smooth>();
+
+            for (int k = 0; k < count; ++k) {
+                if (Checks && inCardioidOrBulb(cr[k], ci[k])) {
+                    out[k] = iterations;
+                    stats.cardioid_saved += iterations;
+                    if (zr_out) {
+                        zr_out[k] = 0;
+                        zi_out[k] = 0;
+                    }
+                    continue;
+                }
+
+                Real zr = 0,
+                     zi = 0,
+                     saved_r = 0,
+                     saved_i = 0;
+                long long next_save = 1;
+                int i,
+                    passes = iterations;
+
+                for (i = 0; i < iterations; ++i) {
+                    const Real x = (zr * zr - zi * zi) + cr[k];
+                    const Real y = (zi * zr + zr * zi) + ci[k];
+
+                    if (x * x + y * y > radius2) {
+                        passes = i + 1;
+                        zr = x;
+                        zi = y;
+                        break;
+                    }
+
+                    zr = x;
+                    zi = y;
+
+                    if (Checks) {
+                        const Real dr = zr - saved_r,
+                                   di = zi - saved_i;
+                        if (dr * dr + di * di < tolerance) {
+                            passes = i + 1;
+                            stats.periodicity_saved += iterations - passes;
+                            i = iterations;
+                            break;
+                        }
+                        if (i + 1 == next_save) {
+                            saved_r = zr;
+                            saved_i = zi;
+                            next_save *= 2;
+                        }
+                    }
+                }
+                out[k] = i;
+                stats.iterations += passes;
+                if (zr_out) {
+                    zr_out[k] = zr;
+                    zi_out[k] = zi;
+                }
+            }
+        }
+
+#ifdef CPU_X86_SIMD
+        // ------------------
+        // lane helpers, one struct per ISA and precision
+        struct SSE2Float
+        {
+            using Real = float;
+            using V = __m128;
+            static constexpr int lanes = 4;
+
+            CPU_TARGET("sse2") static V load(const float *p) { return _mm_loadu_ps(p); }
+            CPU_TARGET("sse2") static void store(float *p, V v) { _mm_storeu_ps(p, v); }
+            CPU_TARGET("sse2") static V set1(const float v) { return _mm_set1_ps(v); }
+            CPU_TARGET("sse2") static V add(V a, V b) { return _mm_add_ps(a, b); }
+            CPU_TARGET("sse2") static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+            CPU_TARGET("sse2") static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+            CPU_TARGET("sse2") static unsigned greater(V a, V b)
+            {
+                return static_cast <unsigned>(_mm_movemask_ps(_mm_cmpgt_ps(a, b)));
+            }
+        };
+
+        struct SSE2Double
+        {
+            using Real = double;
+            using V = __m128d;
+            static constexpr int lanes = 2;
+
+            CPU_TARGET("sse2") static V load(const double *p) { return _mm_loadu_pd(p); }
+            CPU_TARGET("sse2") static void store(double *p, V v) { _mm_storeu_pd(p, v); }
+            CPU_TARGET("sse2") static V set1(const double v) { return _mm_set1_pd(v); }
+            CPU_TARGET("sse2") static V add(V a, V b) { return _mm_add_pd(a, b); }
+            CPU_TARGET("sse2") static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+            CPU_TARGET("sse2") static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+            CPU_TARGET("sse2") static unsigned greater(V a, V b)
+            {
+                return static_cast <unsigned>(_mm_movemask_pd(_mm_cmpgt_pd(a, b)));
+            }
+        };
+
+        struct AVX2Float
+        {
+            using Real = float;
+            using V = __m256;
+            static constexpr int lanes = 8;
+
+            CPU_TARGET("avx2") static V load(const float *p) { return _mm256_loadu_ps(p); }
+            CPU_TARGET("avx2") static void store(float *p, V v) { _mm256_storeu_ps(p, v); }
+            CPU_TARGET("avx2") static V set1(const float v) { return _mm256_set1_ps(v); }
+            CPU_TARGET("avx2") static V add(V a, V b) { return _mm256_add_ps(a, b); }
+            CPU_TARGET("avx2") static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+            CPU_TARGET("avx2") static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+            CPU_TARGET("avx2") static unsigned greater(V a, V b)
+            {
+                return static_cast <unsigned>(
+                    _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ)));
+            }
+        };
+
+        struct AVX2Double
+        {
+            using Real = double;
+            using V = __m256d;
+            static constexpr int lanes = 4;
+
+            CPU_TARGET("avx2") static V load(const double *p) { return _mm256_loadu_pd(p); }
+            CPU_TARGET("avx2") static void store(double *p, V v) { _mm256_storeu_pd(p, v); }
+            CPU_TARGET("avx2") static V set1(const double v) { return _mm256_set1_pd(v); }
+            CPU_TARGET("avx2") static V add(V a, V b) { return _mm256_add_pd(a, b); }
+            CPU_TARGET("avx2") static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+            CPU_TARGET("avx2") static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+            CPU_TARGET("avx2") static unsigned greater(V a, V b)
+            {
+                return static_cast <unsigned>(
+                    _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ)));
+            }
+        };
+
+        struct AVX512Float
+        {
+            using Real = float;
+            using V = __m512;
+            static constexpr int lanes = 16;
+
+            CPU_TARGET("avx512f") static V load(const float *p) { return _mm512_loadu_ps(p); }
+            CPU_TARGET("avx512f") static void store(float *p, V v) { _mm512_storeu_ps(p, v); }
+            CPU_TARGET("avx512f") static V set1(const float v) { return _mm512_set1_ps(v); }
+            CPU_TARGET("avx512f") static V add(V a, V b) { return _mm512_add_ps(a, b); }
+            CPU_TARGET("avx512f") static V sub(V a, V b) { return _mm512_sub_ps(a, b); }
+            CPU_TARGET("avx512f") static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+            CPU_TARGET("avx512f") static unsigned greater(V a, V b)
+            {
+                return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ);
+            }
+        };
+
+        struct AVX512Double
+        {
+            using Real = double;
+            using V = __m512d;
+            static constexpr int lanes = 8;
+
+            CPU_TARGET("avx512f") static V load(const double *p) { return _mm512_loadu_pd(p); }
+            CPU_TARGET("avx512f") static void store(double *p, V v) { _mm512_storeu_pd(p, v); }
+            CPU_TARGET("avx512f") static V set1(const double v) { return _mm512_set1_pd(v); }
+            CPU_TARGET("avx512f") static V add(V a, V b) { return _mm512_add_pd(a, b); }
+            CPU_TARGET("avx512f") static V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+            CPU_TARGET("avx512f") static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+            CPU_TARGET("avx512f") static unsigned greater(V a, V b)
+            {
+                return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ);
+            }
+        };
+
+        // ------------------
+        // the loop of mandelbrot.fs over the lanes set in active. Escaped
+        // lanes keep iterating (their results are already stored), the
+        // mask only decides when the whole group can stop.
+        template <class L, bool Checks, bool Smooth>
+        void laneGroup(const typename L::Real *cr, const typename L::Real *ci,
+                       unsigned active, const int iterations, int *out,
+                       typename L::Real *zr_out, typename L::Real *zi_out,
+                       KernelStats &stats)
+        {
+            using Real = typename L::Real;
+            using V = typename L::V;
+
+            if (!active) {
+                return;
+            }
+
+            const V vcr = L::load(cr),
+                    vci = L::load(ci),
+                    radius2 = L::set1(bailout <Real, Smooth>()),
+                    tolerance = L::set1(periodTolerance <Real>());
+            V zr = L::set1(Real(0)),
+              zi = L::set1(Real(0)),
+              saved_r = zr,
+              saved_i = zi;
+            long long next_save = 1;
+
+            // ---------------
+            // z of the lanes in mask, when the caller wants it
+            const auto store_z = [&](const V &vr, const V &vi, unsigned mask) {
+                if (!zr_out || !mask) {
+                    return;
+                }
+                Real r[L::lanes], im[L::lanes];
+                L::store(r, vr);
+                L::store(im, vi);
+                for (; mask; mask &= mask - 1) {
+                    const int l = __builtin_ctz(mask);
+                    zr_out[l] = r[l];
+                    zi_out[l] = im[l];
+                }
+            };
+
+            for (int i = 0; i < iterations && active; ++i) {
+                const V x = L::add(L::sub(L::mul(zr, zr), L::mul(zi, zi)), vcr);
+                const V y = L::add(L::add(L::mul(zi, zr), L::mul(zr, zi)), vci);
+
+                unsigned escaped = L::greater(L::add(L::mul(x, x), L::mul(y, y)), radius2)
+                                 & active;
+                active &= ~escaped;
+                store_z(x, y, escaped);
+
+                for (; escaped; escaped &= escaped - 1) {
+                    out[__builtin_ctz(escaped)] = i;
+                    stats.iterations += i + 1;
+                }
+
+                zr = x;
+                zi = y;
+
+                if (Checks) {
+                    const V dr = L::sub(zr, saved_r),
+                            di = L::sub(zi, saved_i);
+                    unsigned periodic = L::greater(tolerance,
+                                                   L::add(L::mul(dr, dr), L::mul(di, di)))
+                                      & active;
+                    active &= ~periodic;
+                    store_z(zr, zi, periodic);
+
+                    for (; periodic; periodic &= periodic - 1) {
+                        out[__builtin_ctz(periodic)] = iterations;
+                        stats.iterations += i + 1;
+                        stats.periodicity_saved += iterations - (i + 1);
+                    }
+
+                    if (i + 1 == next_save) {
+                        saved_r = zr;
+                        saved_i = zi;
+                        next_save *= 2;
+                    }
+                }
+            }
+
+            store_z(zr, zi, active);
+            for (; active; active &= active - 1) {
+                out[__builtin_ctz(active)] = iterations;
+                stats.iterations += iterations;
+            }
+        }
+
+        // ------------------
+        // cardioid and bulb points are answered before their group
+        // starts, so a group made of them only costs the test
+        template <class L, bool Checks>
+        unsigned activeLanes(const typename L::Real *cr, const typename L::Real *ci,
+                             const int count, const int iterations, int *out,
+                             typename L::Real *zr_out, typename L::Real *zi_out,
+                             KernelStats &stats)
+        {
+            unsigned active = (1u << count) - 1;
+
+            if (Checks) {
+                for (int l = 0; l < count; ++l) {
+                    if (inCardioidOrBulb(cr[l], ci[l])) {
+                        active &= ~(1u << l);
+                        out[l] = iterations;
+                        stats.cardioid_saved += iterations;
+                        if (zr_out) {
+                            zr_out[l] = 0;
+                            zi_out[l] = 0;
+                        }
+                    }
+                }
+            }
+            return active;
+        }
+
+        // ------------------
+        // full groups are loaded in place, the tail goes through a
+        // padded copy and its missing lanes start inactive
+        template <class L, bool Checks, bool Smooth>
+        void laneKernel(const typename L::Real *cr, const typename L::Real *ci,
+                        const int count, const int iterations, int *out,
+                        typename L::Real *zr, typename L::Real *zi, KernelStats &stats)
+        {
+            using Real = typename L::Real;
+            int k = 0;
+
+            for (; k + L::lanes <= count; k += L::lanes) {
+                Real *zr_k = zr ? zr + k : nullptr,
+                     *zi_k = zi ? zi + k : nullptr;
+                const unsigned active = activeLanes <L, Checks>(cr + k, ci + k, L::lanes, iterations,
+                                                                out + k, zr_k, zi_k, stats);
+                laneGroup <L, Checks, Smooth>(cr + k, ci + k, active, iterations, out + k,
+                                      zr_k, zi_k, stats);
+            }
+
+            if (k < count) {
+                Real tail_r[L::lanes] = {},
+                     tail_i[L::lanes] = {},
+                     tail_zr[L::lanes],
+                     tail_zi[L::lanes];
+                int tail_out[L::lanes];
+                const std::size_t tail = static_cast <std::size_t>(count - k);
+
+                std::memcpy(tail_r, cr + k, tail * sizeof(Real));
+                std::memcpy(tail_i, ci + k, tail * sizeof(Real));
+
+                Real *zr_k = zr ? tail_zr : nullptr,
+                     *zi_k = zi ? tail_zi : nullptr;
+                const unsigned active = activeLanes <L, Checks>(tail_r, tail_i, count - k, iterations,
+                                                                tail_out, zr_k, zi_k, stats);
+                laneGroup <L, Checks, Smooth>(tail_r, tail_i, active, iterations, tail_out,
+                                      zr_k, zi_k, stats);
+                std::memcpy(out + k, tail_out, tail * sizeof(int));
+
+                if (zr) {
+                    std::memcpy(zr + k, tail_zr, tail * sizeof(Real));
+                    std::memcpy(zi + k, tail_zi, tail * sizeof(Real));
+                }
+            }
+        }
+
+        template <bool Checks, bool Smooth>
+        CPU_KERNEL("sse2") void sse2Float(const float *cr, const float *ci, int count,
+                                          int iterations, int *out, float *zr, float *zi,
+                                          KernelStats &stats)
+        {
+            laneKernel <SSE2Float, Checks, Smooth>(cr, ci, count, iterations, out, zr, zi, stats);
+        }
+
+        template <bool Checks, bool Smooth>
+        CPU_KERNEL("sse2") void sse2Double(const double *cr, const double *ci, int count,
+                                           int iterations, int *out, double *zr, double *zi,
+                                           KernelStats &stats)
+        {
+            laneKernel <SSE2Double, Checks, Smooth>(cr, ci, count, iterations, out, zr, zi, stats);
+        }
+
+        template <bool Checks, bool Smooth>
+        CPU_KERNEL("avx2") void avx2Float(const float *cr, const float *ci, int count,
+                                          int iterations, int *out, float *zr, float *zi,
+                                          KernelStats &stats)
+        {
+            laneKernel <AVX2Float, Checks, Smooth>(cr, ci, count, iterations, out, zr, zi, stats);
+        }
+
+        template <bool Checks, bool Smooth>
+        CPU_KERNEL("avx2") void avx2Double(const double *cr, const double *ci, int count,
+                                           int iterations, int *out, double *zr, double *zi,
+                                           KernelStats &stats)
+        {
+            laneKernel <AVX2Double, Checks, Smooth>(cr, ci, count, iterations, out, zr, zi, stats);
+        }
+
+        template <bool Checks, bool Smooth>
+        CPU_KERNEL("avx512f") void avx512Float(const float *cr, const float *ci, int count,
+                                               int iterations, int *out, float *zr, float *zi,
+                                               KernelStats &stats)
+        {
+            laneKernel <AVX512Float, Checks, Smooth>(cr, ci, count, iterations, out, zr, zi, stats);
+        }
+
+        template <bool Checks, bool Smooth>
+        CPU_KERNEL("avx512f") void avx512Double(const double *cr, const double *ci, int count,
+                                                int iterations, int *out, double *zr, double *zi,
+                                                KernelStats &stats)
+        {
+            laneKernel <AVX512Double, Checks, Smooth>(cr, ci, count, iterations, out, zr, zi, stats);
+        }
+#endif
+    };
+
+    namespace detail
+    {
+        template <class Real, bool Checks, bool Smooth>
+        Kernel <Real> kernelOf(const Isa isa)
+        {
+#ifdef CPU_X86_SIMD
+            if constexpr (std::is_same <Real, float>::value) {
+                switch (isa) {
+                    case Isa::SSE2:
+                    return sse2Float <Checks, Smooth>;
+                    case Isa::AVX2:
+                    return avx2Float <Checks, Smooth>;
+                    case Isa::AVX512:
+                    return avx512Float <Checks, Smooth>;
+                    default:
+                    break;
+                }
+            }
+            else if constexpr (std::is_same <Real, double>::value) {
+                switch (isa) {
+                    case Isa::SSE2:
+                    return sse2Double <Checks, Smooth>;
+                    case Isa::AVX2:
+                    return avx2Double <Checks, Smooth>;
+                    case Isa::AVX512:
+                    return avx512Double <Checks, Smooth>;
+                    default:
+                    break;
+                }
+            }
+#endif
+            static_cast <void>(isa);
+            return scalarKernel <Real, Checks, Smooth>;
+        }
+    };
+
+    // ------------------
+    // kernel for the given ISA; asking for an ISA the machine does not
+    // have is the caller's mistake, use detectIsa() to stay safe.
+    // checks turns the cardioid / bulb test and periodicity checking on,
+    // smooth the escape radius of smooth coloring.
+    // Multi-double types only come as the scalar template.
+    template <class Real>
+    Kernel <Real> kernelFor(const Isa isa, const bool checks = true, const bool smooth = false)
+    {
+        if (checks) {
+            return smooth ? detail::kernelOf <Real, true, true>(isa) :
+                            detail::kernelOf <Real, true, false>(isa);
+        }
+        return smooth ? detail::kernelOf <Real, false, true>(isa) :
+                        detail::kernelOf <Real, false, false>(isa);
+    }
+};
+
+#ifdef CPU_X86_SIMD
+#pragma GCC diagnostic pop
+#endif
+
+#endif  //SIMD_KERNEL_HPP
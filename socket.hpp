@@ -0,0 +1,269 @@
+/* The little of TCP the distributed renderer needs, over BSD sockets or
+   Winsock: a listening socket, connections both ways, sending all of a
+   buffer, receiving what has arrived, and waiting for any of several
+   sockets to have something to read.
+
+   Errors throw, except on receive, where a closed or broken connection
+   is a normal event (a worker that died) and returns 0. Writing to a
+   closed connection raises no SIGPIPE.*/
+
+#ifndef SOCKET_HPP
+#define SOCKET_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+class Socket
+{
+public:
+#ifdef _WIN32
+    using Handle = SOCKET;
+    static constexpr Handle INVALID = INVALID_SOCKET;
+#else
+    using Handle = int;
+    static constexpr Handle INVALID = -1;
+#endif
+
+    Socket() = default;
+
+    Socket(Socket &&other)
+        : handle(other.handle)
+    {
+        other.handle = INVALID;
+    }
+
+    Socket &operator=(Socket &&other)
+    {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+
+    Socket(const Socket &) = delete;
+    Socket &operator=(const Socket &) = delete;
+
+    ~Socket()
+    {
+        close();
+    }
+
+    bool isOpen() const
+    {
+        return handle != INVALID;
+    }
+
+    void close()
+    {
+        if (handle != INVALID) {
+#ifdef _WIN32
+            closesocket(handle);
+#else
+            ::close(handle);
+#endif
+            handle = INVALID;
+        }
+    }
+
+    // ------------------------
+    // ends the connection both ways, which wakes up a thread waiting
+    // in receive()
+    void shutdown()
+    {
+        if (handle != INVALID) {
+#ifdef _WIN32
+            ::shutdown(handle, SD_BOTH);
+#else
+            ::shutdown(handle, SHUT_RDWR);
+#endif
+        }
+    }
+
+    // ------------------------
+    // listens on port (0 for any free one) of the loopback interface
+    // only, or of every interface
+    static Socket listen(const int port, const bool loopback_only)
+    {
+        startup();
+        Socket socket(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+        if (!socket.isOpen()) {
+            throw std::runtime_error("Socket: cannot create a socket\n");
+        }
+
+        const int yes = 1;
+        setsockopt(socket.handle, SOL_SOCKET, SO_REUSEADDR,
+                   reinterpret_cast <const char *>(&yes), sizeof(yes));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast <unsigned short>(port));
+        address.sin_addr.s_addr = htonl(loopback_only ? INADDR_LOOPBACK : INADDR_ANY);
+
+        if (bind(socket.handle, reinterpret_cast <sockaddr *>(&address), sizeof(address)) != 0 ||
+            ::listen(socket.handle, SOMAXCONN) != 0) {
+            throw std::runtime_error("Socket: cannot listen on port " + std::to_string(port) + "\n");
+        }
+        return socket;
+    }
+
+    // ------------------------
+    // port a listening socket got
+    int port() const
+    {
+        sockaddr_in address = {};
+        socklen_t length = sizeof(address);
+        getsockname(handle, reinterpret_cast <sockaddr *>(&address), &length);
+        return ntohs(address.sin_port);
+    }
+
+    Socket accept() const
+    {
+        Socket socket(::accept(handle, nullptr, nullptr));
+        socket.configure();
+        return socket;
+    }
+
+    static Socket connect(const std::string &host, const int port)
+    {
+        startup();
+        addrinfo hints = {},
+                 *found = nullptr;
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
+        const std::string service = std::to_string(port);
+        if (getaddrinfo(host.c_str(), service.c_str(), &hints, &found) != 0) {
+            throw std::runtime_error("Socket: unknown host " + host + "\n");
+        }
+
+        Socket socket;
+        for (addrinfo *a = found; a && !socket.isOpen(); a = a->ai_next) {
+            Socket candidate(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+            if (candidate.isOpen() &&
+                ::connect(candidate.handle, a->ai_addr, static_cast <socklen_t>(a->ai_addrlen)) == 0) {
+                socket = std::move(candidate);
+            }
+        }
+        freeaddrinfo(found);
+
+        if (!socket.isOpen()) {
+            throw std::runtime_error("Socket: cannot connect to " + host + ":" + service + "\n");
+        }
+        socket.configure();
+        return socket;
+    }
+
+    // ------------------------
+    // all of data, or throws
+    void sendAll(const void *data, std::size_t size)
+    {
+        const char *bytes = static_cast <const char *>(data);
+        while (size > 0) {
+            const int chunk = static_cast <int>(std::min <std::size_t>(size, 1 << 30));
+            const auto sent = send(handle, bytes, chunk, SEND_FLAGS);
+            if (sent <= 0) {
+                throw std::runtime_error("Socket: the connection is closed\n");
+            }
+            bytes += sent;
+            size -= static_cast <std::size_t>(sent);
+        }
+    }
+
+    // ------------------------
+    // what has arrived, up to size bytes, waiting for some if nothing
+    // has; 0 once the connection is closed or broken
+    std::size_t receive(void *data, const std::size_t size)
+    {
+        const auto received = recv(handle, static_cast <char *>(data),
+                                   static_cast <int>(std::min <std::size_t>(size, 1 << 30)), 0);
+        return received > 0 ? static_cast <std::size_t>(received) : 0;
+    }
+
+    // ------------------------
+    // which of sockets have something to read (or were closed), after
+    // waiting at most timeout seconds for one of them
+    static std::vector <bool> readable(const std::vector <const Socket *> &sockets,
+                                       const double timeout)
+    {
+        fd_set set;
+        FD_ZERO(&set);
+        Handle highest = 0;
+        for (const Socket *socket : sockets) {
+            FD_SET(socket->handle, &set);
+            highest = std::max(highest, socket->handle);
+        }
+
+        timeval wait;
+        wait.tv_sec = static_cast <long>(timeout);
+        wait.tv_usec = static_cast <long>((timeout - static_cast <long>(timeout)) * 1e6);
+        select(static_cast <int>(highest + 1), &set, nullptr, nullptr, &wait);
+
+        std::vector <bool> ready(sockets.size());
+        for (std::size_t s = 0; s < sockets.size(); ++s) {
+            ready[s] = FD_ISSET(sockets[s]->handle, &set) != 0;
+        }
+        return ready;
+    }
+
+private:
+#if defined(MSG_NOSIGNAL)
+    static constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    static constexpr int SEND_FLAGS = 0;
+#endif
+
+    Handle handle = INVALID;
+
+    explicit Socket(const Handle socket_handle)
+        : handle(socket_handle)
+    {}
+
+    // ------------------------
+    // messages are small and answered at once: no Nagle delay
+    void configure()
+    {
+        if (!isOpen()) {
+            throw std::runtime_error("Socket: cannot accept a connection\n");
+        }
+        const int yes = 1;
+        setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast <const char *>(&yes),
+                   sizeof(yes));
+#ifdef SO_NOSIGPIPE
+        setsockopt(handle, SOL_SOCKET, SO_NOSIGPIPE, reinterpret_cast <const char *>(&yes),
+                   sizeof(yes));
+#endif
+    }
+
+    static void startup()
+    {
+#ifdef _WIN32
+        static const bool started = []() {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        if (!started) {
+            throw std::runtime_error("Socket: WSAStartup failed\n");
+        }
+#endif
+    }
+};
+
+#endif  //SOCKET_HPP
@@ -0,0 +1,194 @@
+/* Thread pool used by the CPU renderers.
+   Every call to run() hands out a batch of task indices; each worker
+   owns a deque of them and, once it is empty, steals from the front of
+   the other workers' deques. Mandelbrot tiles differ in cost by orders
+   of magnitude (interior vs exterior), so a static split would leave
+   cores idle while one thread finishes the expensive part of the frame.*/
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    using Task = std::function <void(std::size_t index, unsigned worker)>;
+
+    // ------------------------
+    // thread_count includes the calling thread, which takes part
+    // in every run() as worker 0
+    explicit ThreadPool(unsigned thread_count = std::thread::hardware_concurrency())
+    {
+        if (thread_count == 0) {
+            thread_count = 1;
+        }
+
+        for (unsigned i = 0; i < thread_count; ++i) {
+            queues.emplace_back(new Queue);
+        }
+
+        for (unsigned i = 1; i < thread_count; ++i) {
+            threads.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard <std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    unsigned size() const
+    {
+        return static_cast <unsigned>(queues.size());
+    }
+
+    // ------------------------
+    // calls task(i, worker) for every i in [0, task_count) and blocks
+    // until all of them are finished. The first exception thrown by a
+    // task is rethrown here once the batch has drained.
+    void run(const std::size_t task_count, const Task &task)
+    {
+        if (task_count == 0) {
+            return;
+        }
+
+        // -------------------
+        // contiguous chunks keep neighbouring tiles on one thread,
+        // stealing takes care of the imbalance
+        const std::size_t workers = queues.size();
+        for (std::size_t w = 0; w < workers; ++w) {
+            std::lock_guard <std::mutex> lock(queues[w]->mutex);
+            const std::size_t first = task_count * w / workers,
+                              last = task_count * (w + 1) / workers;
+            for (std::size_t i = first; i < last; ++i) {
+                queues[w]->tasks.push_back(i);
+            }
+        }
+
+        {
+            std::lock_guard <std::mutex> lock(mutex);
+            job = &task;
+            error = nullptr;
+            busy = static_cast <unsigned>(threads.size());
+            ++generation;
+        }
+        wake.notify_all();
+
+        work(0);
+
+        std::unique_lock <std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+        job = nullptr;
+
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque <std::size_t> tasks;
+    };
+
+    std::vector <std::unique_ptr <Queue>> queues;
+    std::vector <std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const Task *job = nullptr;
+    std::exception_ptr error;
+    unsigned busy = 0;
+    unsigned long long generation = 0;
+    bool stop = false;
+
+    // -----------------------
+    // own tasks are taken from the back, stolen ones from the front
+    bool take(const unsigned worker, std::size_t &index)
+    {
+        {
+            Queue &own = *queues[worker];
+            std::lock_guard <std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                index = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        const std::size_t workers = queues.size();
+        for (std::size_t k = 1; k < workers; ++k) {
+            Queue &victim = *queues[(worker + k) % workers];
+            std::lock_guard <std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                index = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(const unsigned worker)
+    {
+        std::size_t index;
+        while (take(worker, index)) {
+            try {
+                (*job)(index, worker);
+            }
+            catch (...) {
+                std::lock_guard <std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    }
+
+    void workerLoop(const unsigned worker)
+    {
+        unsigned long long seen = 0;
+
+        for (;;) {
+            {
+                std::unique_lock <std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stop || generation != seen; });
+                if (stop) {
+                    return;
+                }
+                seen = generation;
+            }
+
+            work(worker);
+
+            std::lock_guard <std::mutex> lock(mutex);
+            if (--busy == 0) {
+                done.notify_one();
+            }
+        }
+    }
+};
+
+#endif  //THREAD_POOL_HPP
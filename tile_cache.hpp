@@ -0,0 +1,325 @@
+/* Cache of rendered tiles, kept in two levels: the most recently used
+   tiles stay in memory up to a byte budget, the ones pushed out of it
+   go to fixed size slots of a memory-mapped scratch file, which has a
+   budget of its own and drops its least recently used tile when full.
+   A tile found on disk moves back to memory.
+
+   Tiles are plain arrays of iteration counts, all of the same size,
+   addressed by their level, position and iteration cap (see
+   tiled_renderer.hpp). Every member function locks, so renderer
+   threads can share one cache.*/
+
+#ifndef TILE_CACHE_HPP
+#define TILE_CACHE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+struct TileKey
+{
+    int level = 0;
+    long long tx = 0,
+              ty = 0;
+    int iterations = 0;
+
+    friend bool operator==(const TileKey &a, const TileKey &b)
+    {
+        return a.level == b.level && a.tx == b.tx && a.ty == b.ty &&
+               a.iterations == b.iterations;
+    }
+};
+
+struct TileKeyHash
+{
+    std::size_t operator()(const TileKey &key) const
+    {
+        std::size_t h = std::hash <long long>()(key.tx);
+        for (const long long v : {key.ty, static_cast <long long>(key.level),
+                                  static_cast <long long>(key.iterations)}) {
+            h ^= std::hash <long long>()(v) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+        }
+        return h;
+    }
+};
+
+// ------------------
+// file of a fixed size mapped in memory, removed when closed
+class MappedFile
+{
+public:
+    MappedFile(const std::string &file_path, const std::size_t file_size)
+        : path(file_path), size(file_size)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
+        if (file != INVALID_HANDLE_VALUE) {
+            mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE,
+                                         static_cast <DWORD>(static_cast <unsigned long long>(size) >> 32),
+                                         static_cast <DWORD>(size & 0xffffffffu), NULL);
+        }
+        if (mapping) {
+            bytes = static_cast <unsigned char *>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS,
+                                                                0, 0, size));
+        }
+#else
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd >= 0 && ftruncate(fd, static_cast <off_t>(size)) == 0) {
+            void *view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (view != MAP_FAILED) {
+                bytes = static_cast <unsigned char *>(view);
+            }
+        }
+#endif
+        if (!bytes) {
+            close();
+            throw std::runtime_error("MappedFile: cannot map " + path + "\n");
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    unsigned char *data()
+    {
+        return bytes;
+    }
+
+private:
+    std::string path;
+    std::size_t size;
+    unsigned char *bytes = nullptr;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE,
+           mapping = NULL;
+#else
+    int fd = -1;
+#endif
+
+    void close()
+    {
+#ifdef _WIN32
+        if (bytes) {
+            UnmapViewOfFile(bytes);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+#else
+        if (bytes) {
+            munmap(bytes, size);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+        std::remove(path.c_str());
+    }
+};
+
+struct TileCacheStats
+{
+    std::size_t memory_hits = 0,
+                disk_hits = 0,
+                misses = 0,
+                // tiles moved from memory to disk
+                spilled = 0,
+                // tiles dropped for good
+                evicted = 0;
+};
+
+class TileCache
+{
+public:
+    // --------------------
+    // tiles of tile_size counts; without a spill path, tiles pushed
+    // out of memory are dropped
+    TileCache(const std::size_t tile_size, const std::size_t memory_budget,
+              const std::string &spill_path = "", const std::size_t disk_budget = 0)
+        : tile_counts(tile_size),
+          memory_slots(std::max <std::size_t>(memory_budget / tileBytes(), 1))
+    {
+        const std::size_t disk_slots = disk_budget / tileBytes();
+        if (!spill_path.empty() && disk_slots > 0) {
+            disk.reset(new MappedFile(spill_path, disk_slots * tileBytes()));
+            for (std::size_t slot = disk_slots; slot > 0; --slot) {
+                free_slots.push_back(slot - 1);
+            }
+        }
+    }
+
+    std::size_t tileSize() const
+    {
+        return tile_counts;
+    }
+
+    TileCacheStats stats() const
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        return counters;
+    }
+
+    // --------------------
+    // copies the tile into counts if it is cached
+    bool find(const TileKey &key, std::vector <int> &counts)
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+
+        const auto hit = in_memory.find(key);
+        if (hit != in_memory.end()) {
+            memory.splice(memory.begin(), memory, hit->second);
+            counts = hit->second->counts;
+            ++counters.memory_hits;
+            return true;
+        }
+
+        const auto spilled = on_disk.find(key);
+        if (spilled != on_disk.end()) {
+            counts.resize(tile_counts);
+            std::memcpy(counts.data(), slot(spilled->second.slot), tileBytes());
+            dropFromDisk(spilled);
+            store(key, counts);
+            ++counters.disk_hits;
+            return true;
+        }
+
+        ++counters.misses;
+        return false;
+    }
+
+    void insert(const TileKey &key, const std::vector <int> &counts)
+    {
+        if (counts.size() != tile_counts) {
+            throw std::invalid_argument("TileCache: tile of the wrong size\n");
+        }
+
+        std::lock_guard <std::mutex> lock(mutex);
+
+        const auto spilled = on_disk.find(key);
+        if (spilled != on_disk.end()) {
+            dropFromDisk(spilled);
+        }
+        store(key, counts);
+    }
+
+private:
+    struct Entry
+    {
+        TileKey key;
+        std::vector <int> counts;
+    };
+
+    struct DiskEntry
+    {
+        std::size_t slot;
+        std::list <TileKey>::iterator age;
+    };
+
+    std::size_t tile_counts,
+                memory_slots;
+
+    // --------------------
+    // most recently used first, on both levels
+    std::list <Entry> memory;
+    std::unordered_map <TileKey, std::list <Entry>::iterator, TileKeyHash> in_memory;
+
+    std::unique_ptr <MappedFile> disk;
+    std::list <TileKey> disk_ages;
+    std::unordered_map <TileKey, DiskEntry, TileKeyHash> on_disk;
+    std::vector <std::size_t> free_slots;
+
+    TileCacheStats counters;
+    mutable std::mutex mutex;
+
+    std::size_t tileBytes() const
+    {
+        return tile_counts * sizeof(int);
+    }
+
+    unsigned char *slot(const std::size_t index)
+    {
+        return disk->data() + index * tileBytes();
+    }
+
+    void dropFromDisk(std::unordered_map <TileKey, DiskEntry, TileKeyHash>::iterator it)
+    {
+        free_slots.push_back(it->second.slot);
+        disk_ages.erase(it->second.age);
+        on_disk.erase(it);
+    }
+
+    // --------------------
+    // puts the tile in front of the memory list, or refreshes it, and
+    // spills whatever no longer fits
+    void store(const TileKey &key, const std::vector <int> &counts)
+    {
+        const auto present = in_memory.find(key);
+        if (present != in_memory.end()) {
+            present->second->counts = counts;
+            memory.splice(memory.begin(), memory, present->second);
+            return;
+        }
+
+        memory.push_front(Entry {key, counts});
+        in_memory[key] = memory.begin();
+
+        while (memory.size() > memory_slots) {
+            spill(memory.back());
+            in_memory.erase(memory.back().key);
+            memory.pop_back();
+        }
+    }
+
+    void spill(const Entry &entry)
+    {
+        if (!disk) {
+            ++counters.evicted;
+            return;
+        }
+
+        if (free_slots.empty()) {
+            dropFromDisk(on_disk.find(disk_ages.back()));
+            ++counters.evicted;
+        }
+
+        const std::size_t index = free_slots.back();
+        free_slots.pop_back();
+        std::memcpy(slot(index), entry.counts.data(), tileBytes());
+
+        disk_ages.push_front(entry.key);
+        on_disk[entry.key] = DiskEntry {index, disk_ages.begin()};
+        ++counters.spilled;
+    }
+};
+
+#endif  //TILE_CACHE_HPP
@@ -0,0 +1,261 @@
+/* Renders views out of a pyramid of fixed size tiles kept in a
+   TileCache, so that a region seen before (a revisit, a zoom out after
+   a zoom in) is not iterated again.
+
+   Level L samples the plane every 4 / (TILE * 2^L): sample (u, v) is
+   the point (-2 + u * spacing, 2 - v * spacing) and tile (tx, ty) holds
+   the samples tx * TILE <= u < (tx + 1) * TILE, same for v. Samples
+   sit on grid corners, not in pixel centers, so sample (u, v) of level
+   L is sample (2u, 2v) of level L + 1 and a tile whose four children
+   are cached is put together from them without any iteration.
+
+   A view is drawn from the coarsest level whose spacing is not wider
+   than its pixels, each pixel taking the nearest sample. The precision
+   of a level is the one selectPrecision() picks for its spacing; the
+   precision of the options is not used.*/
+
+#ifndef TILED_RENDERER_HPP
+#define TILED_RENDERER_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include "cpu_renderer.hpp"
+#include "multi_double.hpp"
+#include "simd_kernel.hpp"
+#include "thread_pool.hpp"
+#include "tile_cache.hpp"
+
+namespace CPU
+{
+    struct TiledStats
+    {
+        int level = 0;
+        // tiles the frame needed, and where they came from
+        std::size_t tiles = 0,
+                    cached = 0,
+                    assembled = 0,
+                    rendered = 0;
+        KernelStats kernel;
+    };
+
+    class TiledRenderer
+    {
+    public:
+        // --------------------
+        // samples per tile side. Sample indices must fit in 62 bits,
+        // which gives the deepest level.
+        static constexpr int TILE = 256,
+                             MAX_LEVEL = 52;
+
+        TiledRenderer(ThreadPool &thread_pool, TileCache &tile_cache,
+                      const RenderOptions &opts = RenderOptions())
+            : pool(thread_pool), cache(tile_cache), options(opts)
+        {
+            if (cache.tileSize() != static_cast <std::size_t>(TILE) * TILE) {
+                throw std::invalid_argument("TiledRenderer: the cache holds tiles of another size\n");
+            }
+        }
+
+        RenderOptions &renderOptions()
+        {
+            return options;
+        }
+
+        const TiledStats &lastStats() const
+        {
+            return stats;
+        }
+
+        // --------------------
+        // coarsest level at least as fine as the pixels of the view
+        static int levelFor(const View &view)
+        {
+            const double pixel = 2 / (view.zoom * view.height),
+                         level = std::ceil(std::log2(4 / (TILE * pixel)) - 1e-9);
+            return static_cast <int>(std::max(level, 0.0));
+        }
+
+        void render(const View &view, Frame &frame)
+        {
+            const int level = levelFor(view);
+            if (level > MAX_LEVEL) {
+                throw std::range_error("TiledRenderer: zoom is too deep\n");
+            }
+
+            // -----------------
+            // sample of every column and row, from the center in
+            // sample units of the level
+            const double scale = std::ldexp(TILE / 4.0, level);
+            long long u0, v0;
+            double fu, fv;
+            sampleIndex((view.cx + QuadDouble(2)) * QuadDouble(scale), u0, fu);
+            sampleIndex((QuadDouble(2) - view.cy) * QuadDouble(scale), v0, fv);
+
+            std::vector <long long> us(view.width), vs(view.height);
+            for (int x = 0; x < view.width; ++x) {
+                us[x] = u0 + std::llround(fu + view.offsetRe(x) * scale);
+            }
+            for (int row = 0; row < view.height; ++row) {
+                vs[row] = v0 + std::llround(fv - view.offsetIm(row) * scale);
+            }
+
+            const long long tx0 = floorDiv(us.front(), TILE),
+                            ty0 = floorDiv(vs.front(), TILE);
+            const std::size_t tiles_x = static_cast <std::size_t>(floorDiv(us.back(), TILE) - tx0 + 1),
+                              tiles_y = static_cast <std::size_t>(floorDiv(vs.back(), TILE) - ty0 + 1);
+
+            std::vector <std::vector <int>> tiles(tiles_x * tiles_y);
+            std::vector <TiledStats> worker_stats(pool.size());
+
+            pool.run(tiles.size(), [&](const std::size_t index, const unsigned worker) {
+                TileKey key;
+                key.level = level;
+                key.tx = tx0 + static_cast <long long>(index % tiles_x);
+                key.ty = ty0 + static_cast <long long>(index / tiles_x);
+                key.iterations = view.iterations;
+
+                fetch(key, tiles[index], worker_stats[worker]);
+            });
+
+            frame.resize(view.width, view.height);
+            for (int row = 0; row < view.height; ++row) {
+                const long long ty = floorDiv(vs[row], TILE);
+                const std::size_t tile_row = static_cast <std::size_t>(ty - ty0) * tiles_x,
+                                  j = static_cast <std::size_t>(vs[row] - ty * TILE);
+
+                for (int x = 0; x < view.width; ++x) {
+                    const long long tx = floorDiv(us[x], TILE);
+                    const std::vector <int> &tile = tiles[tile_row + static_cast <std::size_t>(tx - tx0)];
+                    const int i = tile[j * TILE + static_cast <std::size_t>(us[x] - tx * TILE)];
+                    const std::size_t p = static_cast <std::size_t>(row) * view.width + x;
+
+                    frame.iterations[p] = i;
+                    genColor(static_cast <float>(i) / view.iterations, &frame.rgba[p * 4]);
+                }
+            }
+
+            stats = TiledStats();
+            stats.level = level;
+            stats.tiles = tiles.size();
+            for (const TiledStats &s : worker_stats) {
+                stats.cached += s.cached;
+                stats.assembled += s.assembled;
+                stats.rendered += s.rendered;
+                stats.kernel += s.kernel;
+            }
+        }
+
+    private:
+        ThreadPool &pool;
+        TileCache &cache;
+        RenderOptions options;
+        TiledStats stats;
+
+        static long long floorDiv(const long long a, const long long b)
+        {
+            return a >= 0 ? a / b : -((-a + b - 1) / b);
+        }
+
+        // -----------------
+        // n as a QuadDouble, exactly
+        static QuadDouble exact(const long long n)
+        {
+            const long long low = n & 0xffffffffll;
+            return QuadDouble(static_cast <double>(n - low)) + QuadDouble(static_cast <double>(low));
+        }
+
+        static void sampleIndex(const QuadDouble &u, long long &whole, double &fraction)
+        {
+            whole = std::llround(u.x[0]);
+            fraction = (u - exact(whole)).toDouble();
+        }
+
+        void fetch(const TileKey &key, std::vector <int> &counts, TiledStats &tile_stats)
+        {
+            if (cache.find(key, counts)) {
+                ++tile_stats.cached;
+                return;
+            }
+
+            if (assemble(key, counts)) {
+                ++tile_stats.assembled;
+            }
+            else {
+                switch (selectPrecision(std::ldexp(TILE, key.level - 1), 1)) {
+                    case Precision::Double:
+                    renderTile <double>(key, counts, tile_stats.kernel);
+                    break;
+                    case Precision::DoubleDouble:
+                    renderTile <DoubleDouble>(key, counts, tile_stats.kernel);
+                    break;
+                    case Precision::QuadDouble:
+                    renderTile <QuadDouble>(key, counts, tile_stats.kernel);
+                    break;
+                    default:
+                    renderTile <float>(key, counts, tile_stats.kernel);
+                }
+                ++tile_stats.rendered;
+            }
+            cache.insert(key, counts);
+        }
+
+        // -----------------
+        // every other sample of the four children, if they are all
+        // cached
+        bool assemble(const TileKey &key, std::vector <int> &counts)
+        {
+            if (key.level >= MAX_LEVEL) {
+                return false;
+            }
+
+            std::vector <int> children[4];
+            for (int c = 0; c < 4; ++c) {
+                TileKey child = key;
+                child.level = key.level + 1;
+                child.tx = 2 * key.tx + c % 2;
+                child.ty = 2 * key.ty + c / 2;
+                if (!cache.find(child, children[c])) {
+                    return false;
+                }
+            }
+
+            counts.resize(static_cast <std::size_t>(TILE) * TILE);
+            for (int j = 0; j < TILE; ++j) {
+                for (int i = 0; i < TILE; ++i) {
+                    const std::vector <int> &child = children[(2 * j / TILE) * 2 + 2 * i / TILE];
+                    counts[static_cast <std::size_t>(j) * TILE + i] =
+                        child[static_cast <std::size_t>(2 * j % TILE) * TILE + 2 * i % TILE];
+                }
+            }
+            return true;
+        }
+
+        template <class Real>
+        void renderTile(const TileKey &key, std::vector <int> &counts, KernelStats &kernel_stats)
+        {
+            const Kernel <Real> kernel = kernelFor <Real>(options.isa, options.interior_checks);
+            const double spacing = std::ldexp(4.0 / TILE, -key.level);
+            const QuadDouble re0 = QuadDouble(-2) + exact(key.tx * TILE) * QuadDouble(spacing),
+                             im0 = QuadDouble(2) - exact(key.ty * TILE) * QuadDouble(spacing);
+
+            std::vector <Real> cr(TILE), ci(TILE);
+            for (int i = 0; i < TILE; ++i) {
+                cr[i] = pointOf <Real>(re0, i * spacing);
+            }
+
+            counts.resize(static_cast <std::size_t>(TILE) * TILE);
+            for (int j = 0; j < TILE; ++j) {
+                std::fill(ci.begin(), ci.end(), pointOf <Real>(im0, -j * spacing));
+                kernel(cr.data(), ci.data(), TILE, key.iterations,
+                       &counts[static_cast <std::size_t>(j) * TILE], nullptr, nullptr,
+                       kernel_stats);
+            }
+        }
+    };
+};
+
+#endif  //TILED_RENDERER_HPP
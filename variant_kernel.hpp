@@ -0,0 +1,196 @@
+/* Kernels of the fractal variants (fractal_variant.hpp) other than
+   z^2 + c, which keeps the vectorized kernels of simd_kernel.hpp.
+   The formula, the exponent and the coloring are template arguments:
+   each combination is a loop of its own where if constexpr has removed
+   every other case, and the exponent is a constant count of complex
+   multiplications the compiler unrolls. Only the c of a Julia set is
+   read at run time, once per call.
+
+   These kernels are scalar and skip the cardioid test and periodicity
+   checking, which only hold for z^2 + c. With smooth coloring the
+   escape radius is 256 instead of 2 (FractalVariant::escapeRadius()),
+   so counts are not those of the banded variants; magnitudes receives
+   |z| where it went past the radius, from which smoothFraction() makes
+   the fraction of an iteration to add to the count.*/
+
+#ifndef VARIANT_KERNEL_HPP
+#define VARIANT_KERNEL_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+
+#include "fractal_variant.hpp"
+#include "simd_kernel.hpp"
+
+namespace CPU
+{
+    // ------------------
+    // as Kernel, plus the variant (for the c of a Julia set); unless it
+    // is null, magnitudes[k] receives |z| once past the escape radius,
+    // 0 for the points that did not escape
+    template <class Real>
+    using VariantKernel = void (*)(const Real *cr, const Real *ci, int count, int iterations,
+                                   const FractalVariant &variant, int *out, float *magnitudes,
+                                   KernelStats &stats);
+
+    // ------------------
+    // fraction of an iteration to add to the count of a point that
+    // escaped with |z| = magnitude: log |z| / log radius lies between 1
+    // and power, and its logarithm to the base power between 0 and 1.
+    // Magnitudes not past the radius (inside points, or renderers that
+    // keep none) give 0. The logarithms of radius and power are taken
+    // once, for passes over many pixels.
+    struct SmoothScale
+    {
+        float radius,
+              inverse_log_radius,
+              inverse_log_power;
+
+        SmoothScale(const double escape_radius, const int power)
+            : radius(static_cast <float>(escape_radius)),
+              inverse_log_radius(static_cast <float>(1 / std::log(escape_radius))),
+              inverse_log_power(static_cast <float>(1 / std::log(double(power))))
+        {}
+
+        float fraction(const float magnitude) const
+        {
+            if (!(magnitude > radius)) {
+                return 0.0f;
+            }
+            const float ratio = std::log(magnitude) * inverse_log_radius,
+                        fraction = 1.0f - std::log(ratio) * inverse_log_power;
+            return std::min(std::max(fraction, 0.0f), 0.999f);
+        }
+    };
+
+    inline float smoothFraction(const float magnitude, const double radius, const int power)
+    {
+        return SmoothScale(radius, power).fraction(magnitude);
+    }
+
+    namespace detail
+    {
+        template <class Real>
+        double asDouble(const Real x)
+        {
+            if constexpr (std::is_arithmetic <Real>::value)
+                return static_cast <double>(x);
+            else
+                return x.toDouble();
+        }
+
+        template <class Real>
+        Real absOf(const Real x)
+        {
+            return x < Real(0) ? -x : x;
+        }
+
+        // ------------------
+        // z^Power, by Power - 1 multiplications
+        template <int Power, class Real>
+        void raise(Real &zr, Real &zi)
+        {
+            const Real r = zr,
+                       i = zi;
+            for (int p = 1; p < Power; ++p) {
+                const Real next_r = zr * r - zi * i;
+                zi = zr * i + zi * r;
+                zr = next_r;
+            }
+        }
+
+        template <class Real, Formula F, int Power, bool Smooth>
+        void variantLoop(const Real *cr, const Real *ci, const int count, const int iterations,
+                         const FractalVariant &variant, int *out, float *magnitudes,
+                         KernelStats &stats)
+        {
+            // the square of escapeRadius()
+            const Real bailout = Smooth ? Real(65536) : Real(4);
+            const Real julia_re = Real(variant.julia_re),
+                       julia_im = Real(variant.julia_im);
+
+            for (int k = 0; k < count; ++k) {
+                Real zr = 0,
+                     zi = 0,
+                     c_re = cr[k],
+                     c_im = ci[k];
+                if constexpr (F == Formula::Julia) {
+                    zr = cr[k];
+                    zi = ci[k];
+                    c_re = julia_re;
+                    c_im = julia_im;
+                }
+
+                Real x = zr,
+                     y = zi;
+                int i;
+
+                for (i = 0; i < iterations; ++i) {
+                    x = zr;
+                    y = zi;
+                    if constexpr (F == Formula::BurningShip) {
+                        x = absOf(x);
+                        y = absOf(y);
+                    }
+                    raise <Power>(x, y);
+                    x = x + c_re;
+                    y = y + c_im;
+
+                    if (x * x + y * y > bailout)
+                        break;
+
+                    zr = x;
+                    zi = y;
+                }
+
+                out[k] = i;
+                stats.iterations += i < iterations ? i + 1 : iterations;
+
+                if (magnitudes) {
+                    magnitudes[k] = i < iterations ?
+                                    static_cast <float>(std::sqrt(asDouble(x * x + y * y))) : 0.0f;
+                }
+            }
+        }
+
+        template <class Real, Formula F, bool Smooth>
+        VariantKernel <Real> variantOfPower(const int power)
+        {
+            switch (power) {
+                case 3:
+                return variantLoop <Real, F, 3, Smooth>;
+                case 4:
+                return variantLoop <Real, F, 4, Smooth>;
+                case 5:
+                return variantLoop <Real, F, 5, Smooth>;
+                default:
+                return variantLoop <Real, F, 2, Smooth>;
+            }
+        }
+
+        template <class Real, bool Smooth>
+        VariantKernel <Real> variantOfFormula(const Formula formula, const int power)
+        {
+            switch (formula) {
+                case Formula::BurningShip:
+                return variantOfPower <Real, Formula::BurningShip, Smooth>(power);
+                case Formula::Julia:
+                return variantOfPower <Real, Formula::Julia, Smooth>(power);
+                default:
+                return variantOfPower <Real, Formula::Mandelbrot, Smooth>(power);
+            }
+        }
+    };
+
+    // ------------------
+    // exponents out of [MIN_POWER, MAX_POWER] get the kernel of 2
+    template <class Real>
+    VariantKernel <Real> variantKernelFor(const FractalVariant &variant)
+    {
+        return variant.smooth ? detail::variantOfFormula <Real, true>(variant.formula, variant.power) :
+                                detail::variantOfFormula <Real, false>(variant.formula, variant.power);
+    }
+};
+
+#endif  //VARIANT_KERNEL_HPP